@@ -0,0 +1,504 @@
+#include "BinaryImage.hpp"
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <stdexcept>
+#include <unordered_map>
+#include <utility>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace CConf {
+
+#pragma mark ImageValue
+
+int64_t ImageValue::toInt() const {
+  if (type() == Image::Double) return (int64_t)toDouble();
+  return (int64_t)_record->payload;
+}
+
+double ImageValue::toDouble() const {
+  switch (type()) {
+    case Image::Double: {
+      double value;
+      memcpy(&value, &_record->payload, sizeof(value));
+      return value;
+    }
+    case Image::Int:
+      return (double)(int64_t)_record->payload;
+    case Image::UInt:
+    case Image::Bool:
+      return (double)_record->payload;
+    default:
+      return 0;
+  }
+}
+
+const char* ImageValue::stringData() const {
+  Image::String str = {(uint32_t)_record->payload, _record->count};
+  return _image->_str(str);
+}
+
+string ImageValue::toString() const {
+  return string(stringData(), stringLength());
+}
+
+ImageValue ImageValue::listAt(size_t i) const {
+  return ImageValue(_image, _image->_value((uint32_t)_record->payload + i));
+}
+
+Value ImageValue::toValue() const {
+  switch (type()) {
+    case Image::Bool:
+      return Value(toBool());
+    case Image::Int:
+      return Value(toInt());
+    case Image::UInt:
+      return Value((uint64_t)_record->payload);
+    case Image::Double:
+      return Value(toDouble());
+    case Image::StringValue:
+      return Value(stringData(), stringLength());
+    case Image::List: {
+      vector<Value> lst;
+      lst.reserve(listSize());
+      for (size_t i = 0; i < listSize(); i++) {
+        lst.push_back(listAt(i).toValue());
+      }
+      return Value(std::move(lst));
+    }
+    default:
+      return Value();
+  }
+}
+
+#pragma mark BinaryImage
+
+BinaryImage::BinaryImage(const string& path) : _data(nullptr), _size(0) {
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) throw runtime_error("unable to open image '" + path + "'");
+
+  struct stat info;
+  if (fstat(fd, &info) != 0 || info.st_size == 0) {
+    close(fd);
+    throw runtime_error("unable to read image '" + path + "'");
+  }
+
+  void* mapping = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (mapping == MAP_FAILED) {
+    throw runtime_error("unable to map image '" + path + "'");
+  }
+  _data = (const char*)mapping;
+  _size = info.st_size;
+
+  try {
+    _validate();
+  } catch (const runtime_error& e) {
+    munmap((void*)_data, _size);
+    throw runtime_error("invalid image '" + path + "': " + e.what());
+  }
+}
+
+BinaryImage::~BinaryImage() { munmap((void*)_data, _size); }
+
+void BinaryImage::_validate() const {
+  if (_size < sizeof(Image::Header)) throw runtime_error("truncated header");
+
+  const Image::Header* header = _header();
+  if (memcmp(header->magic, Image::Magic, sizeof(Image::Magic)) != 0) {
+    throw runtime_error("not a config image");
+  }
+  if (header->version != Image::Version) {
+    throw runtime_error("unsupported version " + to_string(header->version));
+  }
+  if (header->nodeCount == 0) throw runtime_error("missing root node");
+
+  //  ImageWriter aligns every table to 8 bytes, and the records are read in
+  //  place
+  auto checkTable = [this](uint64_t offset, uint64_t count, uint64_t size) {
+    if (offset + count * size > _size) throw runtime_error("truncated image");
+    if (size > 1 && offset % 8 != 0) throw runtime_error("misaligned table");
+  };
+  checkTable(header->filesOffset, header->fileCount, sizeof(Image::String));
+  checkTable(header->nodesOffset, header->nodeCount, sizeof(Image::Node));
+  checkTable(header->scopeNodesOffset, header->scopeNodeCount,
+             sizeof(Image::ScopeNode));
+  checkTable(header->valuesOffset, header->valueCount, sizeof(Image::Value));
+  checkTable(header->stringsOffset, header->stringsSize, 1);
+
+  //  Every record is checked once here, so lookups never have to.  Children
+  //  and list elements always come after their parent, which also rules out
+  //  cycles.
+  auto checkString = [header](const Image::String& str) {
+    if ((uint64_t)str.offset + str.length > header->stringsSize) {
+      throw runtime_error("string out of range");
+    }
+  };
+  auto checkRange = [](uint64_t parent, uint64_t first, uint64_t count,
+                       uint64_t tableSize) {
+    if (count > 0 && (first <= parent || first + count > tableSize)) {
+      throw runtime_error("index out of range");
+    }
+  };
+
+  const Image::String* files =
+      (const Image::String*)(_data + header->filesOffset);
+  for (uint32_t i = 0; i < header->fileCount; i++) checkString(files[i]);
+
+  for (uint32_t i = 0; i < header->nodeCount; i++) {
+    const Image::Node& node = *_node(i);
+    checkString(node.name);
+    checkRange(i, node.firstChild, node.childCount, header->nodeCount);
+    if (node.scopeRoot != Image::InvalidIndex &&
+        node.scopeRoot >= header->scopeNodeCount) {
+      throw runtime_error("index out of range");
+    }
+  }
+
+  for (uint32_t i = 0; i < header->scopeNodeCount; i++) {
+    const Image::ScopeNode& scope = *_scopeNode(i);
+    checkString(scope.name);
+    checkRange(i, scope.firstChild, scope.childCount, header->scopeNodeCount);
+    if (scope.value != Image::InvalidIndex &&
+        scope.value >= header->valueCount) {
+      throw runtime_error("index out of range");
+    }
+  }
+
+  for (uint32_t i = 0; i < header->valueCount; i++) {
+    const Image::Value& value = *_value(i);
+    switch (value.type) {
+      case Image::StringValue:
+        if (value.payload > UINT32_MAX) {
+          throw runtime_error("string out of range");
+        }
+        checkString({(uint32_t)value.payload, value.count});
+        break;
+      case Image::List:
+        checkRange(i, value.payload, value.count, header->valueCount);
+        break;
+      default:
+        if (value.type > Image::List) throw runtime_error("unknown value type");
+        break;
+    }
+  }
+}
+
+const Image::Node* BinaryImage::_node(uint32_t i) const {
+  return (const Image::Node*)(_data + _header()->nodesOffset) + i;
+}
+
+const Image::ScopeNode* BinaryImage::_scopeNode(uint32_t i) const {
+  return (const Image::ScopeNode*)(_data + _header()->scopeNodesOffset) + i;
+}
+
+const Image::Value* BinaryImage::_value(uint32_t i) const {
+  return (const Image::Value*)(_data + _header()->valuesOffset) + i;
+}
+
+const char* BinaryImage::_str(const Image::String& s) const {
+  return _data + _header()->stringsOffset + s.offset;
+}
+
+template <typename T>
+uint32_t BinaryImage::_findChild(const T* table, uint32_t first,
+                                 uint32_t count, const char* name,
+                                 size_t length) const {
+  uint32_t lo = first, hi = first + count;
+  while (lo < hi) {
+    uint32_t mid = lo + (hi - lo) / 2;
+    const Image::String& key = table[mid].name;
+    int cmp = memcmp(_str(key), name, min<size_t>(key.length, length));
+    if (cmp == 0) {
+      if (key.length == length) return mid;
+      cmp = key.length < length ? -1 : 1;
+    }
+    if (cmp < 0) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return Image::InvalidIndex;
+}
+
+ImageValue BinaryImage::find(const string& keyPath,
+                             const vector<string>& scope) const {
+  const Image::Node* nodes = _node(0);
+
+  //  walk the key path one segment at a time without splitting it
+  uint32_t index = 0;
+  size_t start = 0;
+  while (true) {
+    size_t end = keyPath.find('.', start);
+    if (end == string::npos) end = keyPath.size();
+
+    const Image::Node& node = nodes[index];
+    index = _findChild(nodes, node.firstChild, node.childCount,
+                       keyPath.data() + start, end - start);
+    if (index == Image::InvalidIndex) return ImageValue();
+
+    if (end == keyPath.size()) break;
+    start = end + 1;
+  }
+
+  uint32_t scopeRoot = nodes[index].scopeRoot;
+  if (scopeRoot == Image::InvalidIndex) return ImageValue();
+
+  //  same resolution as Snapshot::value(): the deepest matching scope with a
+  //  value wins
+  const Image::ScopeNode* scopes = _scopeNode(0);
+  const Image::ScopeNode* level = &scopes[scopeRoot];
+  uint32_t best = level->value;
+  for (const string& name : scope) {
+    uint32_t sub = _findChild(scopes, level->firstChild, level->childCount,
+                              name.data(), name.size());
+    if (sub == Image::InvalidIndex) break;
+    level = &scopes[sub];
+    if (level->value != Image::InvalidIndex) best = level->value;
+  }
+
+  if (best == Image::InvalidIndex) return ImageValue();
+  return ImageValue(this, _value(best));
+}
+
+vector<string> BinaryImage::files() const {
+  const Image::Header* header = _header();
+  const Image::String* files =
+      (const Image::String*)(_data + header->filesOffset);
+
+  vector<string> paths;
+  for (uint32_t i = 0; i < header->fileCount; i++) {
+    paths.push_back(string(_str(files[i]), files[i].length));
+  }
+  return paths;
+}
+
+#pragma mark ImageWriter
+
+void ImageWriter::addValue(const vector<string>& keyPath,
+                           const vector<string>& scope, const Value& value) {
+  Node* node = &_root;
+  for (const string& key : keyPath) node = &node->children[key];
+  node->isLeaf = true;
+
+  Scope* level = &node->scopes;
+  for (const string& name : scope) level = &level->children[name];
+  level->hasValue = true;
+  level->value = value;
+}
+
+namespace {
+
+/// Flattens the writer's trees into the image tables
+struct ImageTables {
+  vector<Image::String> files;
+  vector<Image::Node> nodes;
+  vector<Image::ScopeNode> scopeNodes;
+  vector<Image::Value> values;
+  string strings;
+  unordered_map<string, Image::String> stringIndex;
+
+  Image::String addString(const string& str) {
+    auto itr = stringIndex.find(str);
+    if (itr != stringIndex.end()) return itr->second;
+
+    Image::String ref = {(uint32_t)strings.size(), (uint32_t)str.size()};
+    strings += str;
+    stringIndex[str] = ref;
+    return ref;
+  }
+
+  uint32_t addValue(const Value& value) {
+    uint32_t index = values.size();
+    values.push_back(Image::Value());
+    setValue(index, value);
+    return index;
+  }
+
+  void setValue(uint32_t index, const Value& value) {
+    Image::Value record = {Image::Null, 0, 0};
+    switch (value.type()) {
+      case Value::Bool:
+        record.type = Image::Bool;
+        record.payload = value.toBool();
+        break;
+      case Value::Int:
+        record.type = Image::Int;
+        record.payload = (uint64_t)value.toInt();
+        break;
+      case Value::UInt:
+        record.type = Image::UInt;
+        record.payload = (uint64_t)value.toInt();
+        break;
+      case Value::Double: {
+        double d = value.toDouble();
+        record.type = Image::Double;
+        memcpy(&record.payload, &d, sizeof(d));
+        break;
+      }
+      case Value::String: {
+        Image::String str = addString(value.toString());
+        record.type = Image::StringValue;
+        record.count = str.length;
+        record.payload = str.offset;
+        break;
+      }
+      case Value::List: {
+        //  list elements are stored next to each other, so reserve the whole
+        //  range before filling it in (nested lists append after it)
+        uint32_t first = values.size();
+        values.resize(first + value.listSize());
+        for (size_t i = 0; i < value.listSize(); i++) {
+          setValue(first + i, value.listAt(i));
+        }
+        record.type = Image::List;
+        record.count = value.listSize();
+        record.payload = first;
+        break;
+      }
+      default:
+        break;
+    }
+    values[index] = record;
+  }
+};
+
+/// Appends @root's scope trie breadth-first so that the children of each
+/// scope node are contiguous.  Returns the index of @root.
+template <typename Scope>
+uint32_t FlattenScopes(const Scope& root, ImageTables* tables) {
+  uint32_t rootIndex = tables->scopeNodes.size();
+  deque<pair<const Scope*, uint32_t>> queue;
+  tables->scopeNodes.push_back(Image::ScopeNode());
+  tables->scopeNodes.back().name = {0, 0};
+  queue.push_back(make_pair(&root, rootIndex));
+
+  while (!queue.empty()) {
+    const Scope* scope = queue.front().first;
+    uint32_t index = queue.front().second;
+    queue.pop_front();
+
+    Image::ScopeNode record;
+    record.name = tables->scopeNodes[index].name;
+    record.firstChild = tables->scopeNodes.size();
+    record.childCount = scope->children.size();
+    record.value = scope->hasValue ? tables->addValue(scope->value)
+                                   : Image::InvalidIndex;
+    record.reserved = 0;
+
+    //  std::map keeps the children sorted the way the reader compares them
+    for (auto& child : scope->children) {
+      Image::ScopeNode childRecord = Image::ScopeNode();
+      childRecord.name = tables->addString(child.first);
+      tables->scopeNodes.push_back(childRecord);
+      queue.push_back(make_pair(&child.second, record.firstChild++));
+    }
+    record.firstChild -= record.childCount;
+    tables->scopeNodes[index] = record;
+  }
+  return rootIndex;
+}
+
+template <typename Node>
+void FlattenNodes(const Node& root, ImageTables* tables) {
+  deque<pair<const Node*, uint32_t>> queue;
+  tables->nodes.push_back(Image::Node());
+  tables->nodes.back().name = {0, 0};
+  queue.push_back(make_pair(&root, 0u));
+
+  while (!queue.empty()) {
+    const Node* node = queue.front().first;
+    uint32_t index = queue.front().second;
+    queue.pop_front();
+
+    Image::Node record;
+    record.name = tables->nodes[index].name;
+    record.firstChild = tables->nodes.size();
+    record.childCount = node->children.size();
+    record.scopeRoot = node->isLeaf ? FlattenScopes(node->scopes, tables)
+                                    : Image::InvalidIndex;
+    record.reserved = 0;
+
+    for (auto& child : node->children) {
+      Image::Node childRecord = Image::Node();
+      childRecord.name = tables->addString(child.first);
+      tables->nodes.push_back(childRecord);
+      queue.push_back(make_pair(&child.second, record.firstChild++));
+    }
+    record.firstChild -= record.childCount;
+    tables->nodes[index] = record;
+  }
+}
+
+uint32_t Align8(uint64_t offset) { return (uint32_t)((offset + 7) & ~7ull); }
+
+template <typename T>
+void WriteTable(ofstream& out, const vector<T>& table, uint32_t offset) {
+  static const char padding[8] = {0};
+  out.write(padding, offset - out.tellp());
+  out.write((const char*)table.data(), table.size() * sizeof(T));
+}
+
+};  //  end anonymous namespace
+
+void ImageWriter::write(const string& path) const {
+  ImageTables tables;
+  for (const string& file : _files) {
+    tables.files.push_back(tables.addString(file));
+  }
+  FlattenNodes(_root, &tables);
+
+  Image::Header header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, Image::Magic, sizeof(Image::Magic));
+  header.version = Image::Version;
+
+  uint64_t offset = sizeof(header);
+  auto place = [&offset](size_t count, size_t size, uint32_t* offsetOut) {
+    *offsetOut = Align8(offset);
+    offset = *offsetOut + (uint64_t)count * size;
+  };
+  header.fileCount = tables.files.size();
+  place(tables.files.size(), sizeof(Image::String), &header.filesOffset);
+  header.nodeCount = tables.nodes.size();
+  place(tables.nodes.size(), sizeof(Image::Node), &header.nodesOffset);
+  header.scopeNodeCount = tables.scopeNodes.size();
+  place(tables.scopeNodes.size(), sizeof(Image::ScopeNode),
+        &header.scopeNodesOffset);
+  header.valueCount = tables.values.size();
+  place(tables.values.size(), sizeof(Image::Value), &header.valuesOffset);
+  header.stringsSize = tables.strings.size();
+  place(tables.strings.size(), 1, &header.stringsOffset);
+  if (offset > UINT32_MAX) throw runtime_error("config too large for image");
+
+  //  Write next to the destination and rename over it, so processes that
+  //  still have the old image mapped keep reading the old file.
+  string tmpPath = path + ".tmp";
+  {
+    ofstream out(tmpPath, ios::binary | ios::trunc);
+    out.write((const char*)&header, sizeof(header));
+    WriteTable(out, tables.files, header.filesOffset);
+    WriteTable(out, tables.nodes, header.nodesOffset);
+    WriteTable(out, tables.scopeNodes, header.scopeNodesOffset);
+    WriteTable(out, tables.values, header.valuesOffset);
+    vector<char> strings(tables.strings.begin(), tables.strings.end());
+    WriteTable(out, strings, header.stringsOffset);
+    if (!out) {
+      remove(tmpPath.c_str());
+      throw runtime_error("unable to write image '" + tmpPath + "'");
+    }
+  }
+  if (rename(tmpPath.c_str(), path.c_str()) != 0) {
+    remove(tmpPath.c_str());
+    throw runtime_error("unable to write image '" + path + "'");
+  }
+}
+
+};  //  end namespace CConf
@@ -0,0 +1,206 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+#include "Value.hpp"
+
+namespace CConf {
+
+/// @brief On-disk layout of a compiled config image
+///
+/// @details An image holds the fully resolved tree of a set of cascaded files:
+/// for every leaf, the winning value of each scope that defines one.  All
+/// references are offsets or indices into the image, so it can be used
+/// directly from a read-only mapping of the file.
+///
+/// Layout: header, file table, node table, scope node table, value table and
+/// string table.  The children of a node (and of a scope node) are stored
+/// next to each other, sorted by name, so they can be binary searched.  Node 0
+/// is the root.
+namespace Image {
+
+const char Magic[8] = {'C', 'C', 'O', 'N', 'F', 'I', 'M', 'G'};
+const uint32_t Version = 1;
+const uint32_t InvalidIndex = UINT32_MAX;
+
+struct String {
+  uint32_t offset;  //  into the string table
+  uint32_t length;
+};
+
+struct Header {
+  char magic[8];
+  uint32_t version;
+  uint32_t fileCount;
+  uint32_t filesOffset;
+  uint32_t nodeCount;
+  uint32_t nodesOffset;
+  uint32_t scopeNodeCount;
+  uint32_t scopeNodesOffset;
+  uint32_t valueCount;
+  uint32_t valuesOffset;
+  uint32_t stringsOffset;
+  uint32_t stringsSize;
+  uint32_t reserved;
+};
+
+struct Node {
+  String name;  //  the node's key
+  uint32_t firstChild;
+  uint32_t childCount;
+  /// root of this leaf's scope trie, or InvalidIndex for branches
+  uint32_t scopeRoot;
+  uint32_t reserved;
+};
+
+struct ScopeNode {
+  String name;
+  uint32_t firstChild;
+  uint32_t childCount;
+  /// winning value for exactly this scope, or InvalidIndex
+  uint32_t value;
+  uint32_t reserved;
+};
+
+enum ValueType : uint32_t { Null, Bool, Int, UInt, Double, StringValue, List };
+
+struct Value {
+  uint32_t type;
+  /// string length or list size
+  uint32_t count;
+  /// bool/int/uint value, double bits, string table offset or index of the
+  /// first list element
+  uint64_t payload;
+};
+
+};  //  end namespace Image
+
+class BinaryImage;
+
+/// A value inside a BinaryImage.  Only valid as long as the image is.
+class ImageValue {
+ public:
+  ImageValue() : _image(nullptr), _record(nullptr) {}
+  ImageValue(const BinaryImage* image, const Image::Value* record)
+      : _image(image), _record(record) {}
+
+  bool isValid() const { return _record != nullptr; }
+  Image::ValueType type() const { return (Image::ValueType)_record->type; }
+
+  bool toBool() const { return _record->payload != 0; }
+  int64_t toInt() const;
+  double toDouble() const;
+
+  /// string contents, not null-terminated
+  const char* stringData() const;
+  size_t stringLength() const { return _record->count; }
+  std::string toString() const;
+
+  size_t listSize() const { return _record->count; }
+  ImageValue listAt(size_t i) const;
+
+  /// Converts to the same Value the json would have produced.  Allocates for
+  /// long strings and lists.
+  Value toValue() const;
+
+  /// the value's record in the image, which identifies it
+  const Image::Value* record() const { return _record; }
+
+ private:
+  const BinaryImage* _image;
+  const Image::Value* _record;
+};
+
+/// @brief A compiled config image, mapped read-only into memory
+///
+/// @details Opening an image maps the file and checks that every record only
+/// refers to what's inside the image, so a damaged file is rejected instead
+/// of read out of bounds.  Nothing is parsed or allocated per node.  Lookups walk the node table with
+/// binary searches over sorted children.  Images are written by
+/// Context::writeImage() or the cconf-compile tool.
+///
+/// An open image is immutable and safe to read from any thread.
+class BinaryImage {
+ public:
+  /// Maps the image at @path.  Throws a std::runtime_error if the file can't
+  /// be mapped or isn't a valid image.
+  explicit BinaryImage(const std::string& path);
+  ~BinaryImage();
+
+  BinaryImage(const BinaryImage&) = delete;
+  BinaryImage& operator=(const BinaryImage&) = delete;
+
+  /// @brief Look up the resolved value for a key path
+  ///
+  /// @param keyPath dot-separated path, e.g. "motion.max_accel"
+  /// @param scope the scope to resolve under, e.g. {"2008", "robot17"}
+  /// @return the winning value, or an invalid one if nothing is defined
+  ImageValue find(const std::string& keyPath,
+                  const std::vector<std::string>& scope = {}) const;
+
+  /// The files the image was compiled from, lowest priority first
+  std::vector<std::string> files() const;
+
+  size_t size() const { return _size; }
+
+ private:
+  friend class ImageValue;
+
+  const Image::Header* _header() const { return (const Image::Header*)_data; }
+  const Image::Node* _node(uint32_t i) const;
+  const Image::ScopeNode* _scopeNode(uint32_t i) const;
+  const Image::Value* _value(uint32_t i) const;
+  const char* _str(const Image::String& s) const;
+
+  /// binary search over a contiguous, sorted range of nodes or scope nodes
+  template <typename T>
+  uint32_t _findChild(const T* table, uint32_t first, uint32_t count,
+                      const char* name, size_t length) const;
+
+  /// Throws a std::runtime_error unless the tables fit in the file and every
+  /// index and offset in them is in range
+  void _validate() const;
+
+  const char* _data;
+  size_t _size;
+};
+
+/// @brief Builds an image file
+///
+/// @details Collect the leaves with addValue(), then write().
+class ImageWriter {
+ public:
+  ImageWriter() {}
+
+  void setFiles(const std::vector<std::string>& files) { _files = files; }
+
+  /// Records the winning value for @keyPath under exactly @scope
+  void addValue(const std::vector<std::string>& keyPath,
+                const std::vector<std::string>& scope, const Value& value);
+
+  /// Writes the image to @path.  Throws a std::runtime_error on failure.
+  void write(const std::string& path) const;
+
+ private:
+  struct Scope {
+    Scope() : hasValue(false) {}
+    bool hasValue;
+    Value value;
+    std::map<std::string, Scope> children;
+  };
+
+  struct Node {
+    Node() : isLeaf(false) {}
+    bool isLeaf;
+    Scope scopes;
+    std::map<std::string, Node> children;
+  };
+
+  std::vector<std::string> _files;
+  Node _root;
+};
+
+};  //  end namespace CConf
@@ -1,6 +1,14 @@
 #include "ConfigContext.hpp"
 #include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <cstdio>
+#include <exception>
+#include <functional>
+#include <future>
+#include <iterator>
+#include <sstream>
+#include <thread>
 
 using namespace std;
 
@@ -11,8 +19,9 @@ const std::string CConfScopeKeyPrefix = "$$";
 /**
  * Extracts all of the keys from the given map and puts them in the @keysOut set
  */
-template <typename KeyType, typename ValueType>
-void getMapKeys(const map<KeyType, ValueType>& theMap, set<KeyType>* keysOut) {
+template <typename MapType>
+void getMapKeys(const MapType& theMap,
+                set<typename MapType::key_type>* keysOut) {
   for (auto itr : theMap) {
     keysOut->insert(itr.first);
   }
@@ -23,22 +32,16 @@ void getMapKeys(const map<KeyType, ValueType>& theMap, set<KeyType>* keysOut) {
 Node::Node(Context* context, BranchNode* parent) {
   _parent = parent;
   _context = context;
+  _key = InvalidSymbol;
+  _row = 0;
 }
 
 Node::~Node() {}
 
-int Node::row() {
-  if (_parent) {
-    return _parent->indexOfSubnode(this);
-  } else {
-    return 0;
-  }
-}
-
 void Node::_prependKeyPath(string* keyPathOut) const {
   if (_parent) {
-    keyPathOut->insert(0, ".");
-    keyPathOut->insert(0, _parent->keyForSubnode(this));
+    if (!keyPathOut->empty()) keyPathOut->insert(0, ".");
+    keyPathOut->insert(0, _context->symbols().str(_key));
     _parent->_prependKeyPath(keyPathOut);
   }
 }
@@ -51,62 +54,120 @@ string Node::keyPath() const {
 
 #pragma mark BranchNode
 
-Node* BranchNode::operator[](const string& key) { return _subnodes[key]; }
+Node* BranchNode::operator[](Symbol key) {
+  auto itr = _subnodes.find(key);
+  return itr != _subnodes.end() ? itr->second : nullptr;
+}
 
-Node* BranchNode::_childAtIndex(int index) {
-  return _subnodes[_subnodeOrder[index]];
+const Node* BranchNode::subnode(Symbol key) const {
+  auto itr = _subnodes.find(key);
+  return itr != _subnodes.end() ? itr->second : nullptr;
 }
 
+int BranchNode::rowForNewSubnode(Symbol key) const {
+  const SymbolTable& symbols = context()->symbols();
+  const string& keyStr = symbols.str(key);
+  return std::lower_bound(_subnodeOrder.begin(), _subnodeOrder.end(), keyStr,
+                          [&](const Node* a, const string& b) {
+                            return symbols.str(a->_key) < b;
+                          }) -
+         _subnodeOrder.begin();
+}
+
+Node* BranchNode::_childAtIndex(int index) { return _subnodeOrder[index]; }
+
 int BranchNode::childCount() const { return _subnodes.size(); }
 
-void BranchNode::addSubnode(Node* node, const string& key) {
-  if (_subnodes[key] != nullptr)
+void BranchNode::addSubnode(Node* node, Symbol key) {
+  if ((*this)[key] != nullptr)
     throw invalid_argument(
-        "Attempt to add subnode for key that already exists: '" + key + "'");
+        "Attempt to add subnode for key that already exists: '" +
+        context()->symbols().str(key) + "'");
 
-  _subnodeOrder.push_back(key);
-  std::sort(_subnodeOrder.begin(), _subnodeOrder.end());
+  //  insert in place to keep the order sorted, then shift the rows after it
+  int row = rowForNewSubnode(key);
+  _subnodeOrder.insert(_subnodeOrder.begin() + row, node);
+  _renumberSubnodes(row);
 
   _subnodes[key] = node;
 
+  node->_key = key;
   node->setContext(context());
 }
 
-void BranchNode::removeSubnode(const string& key) {
-  _subnodeOrder.erase(
-      std::find(_subnodeOrder.begin(), _subnodeOrder.end(), key));
+void BranchNode::addSubnodes(const vector<pair<Symbol, Node*>>& sorted) {
+  for (auto& entry : sorted) {
+    if ((*this)[entry.first] != nullptr)
+      throw invalid_argument(
+          "Attempt to add subnode for key that already exists: '" +
+          context()->symbols().str(entry.first) + "'");
+  }
+
+  //  a single merge keeps the order sorted, however many are added
+  const SymbolTable& symbols = context()->symbols();
+  int firstRow = rowForNewSubnode(sorted.front().first);
+  vector<Node*> added;
+  for (auto& entry : sorted) {
+    Node* node = entry.second;
+    node->_key = entry.first;
+    node->setContext(context());
+    _subnodes[entry.first] = node;
+    added.push_back(node);
+  }
+  vector<Node*> merged;
+  merged.reserve(_subnodeOrder.size() + added.size());
+  std::merge(_subnodeOrder.begin(), _subnodeOrder.end(), added.begin(),
+             added.end(), back_inserter(merged),
+             [&](const Node* a, const Node* b) {
+               return symbols.str(a->_key) < symbols.str(b->_key);
+             });
+  _subnodeOrder.swap(merged);
+  _renumberSubnodes(firstRow);
+}
 
+Node* BranchNode::removeSubnode(Symbol key) {
   Node* node = _subnodes[key];
+  _subnodeOrder.erase(_subnodeOrder.begin() + node->_row);
+  _renumberSubnodes(node->_row);
+
+  if (context()) context()->_willRemoveNode(node);
   node->setContext(nullptr);
   _subnodes.erase(key);
-  delete node;
+  return node;
 }
 
-void BranchNode::getSubnodeKeys(set<string>* keysOut) {
-  getMapKeys<string, Node*>(_subnodes, keysOut);
+void BranchNode::_renumberSubnodes(int firstRow) {
+  for (int i = firstRow; i < (int)_subnodeOrder.size(); i++) {
+    _subnodeOrder[i]->_row = i;
+  }
 }
 
-string BranchNode::keyForSubnode(const Node* subnode) const {
-  for (auto itr : _subnodes) {
-    if (itr.second == subnode) {
-      return itr.first;
-    }
-  }
+void BranchNode::getSubnodeKeys(set<Symbol>* keysOut) {
+  getMapKeys(_subnodes, keysOut);
+}
 
-  throw invalid_argument(
-      "keyForSubnode() called for node that isn't a subnode");
+Symbol BranchNode::keyForSubnode(const Node* subnode) const {
+  if (subnode->parent() != this) {
+    throw invalid_argument(
+        "keyForSubnode() called for node that isn't a subnode");
+  }
+  return subnode->key();
 }
 
 int BranchNode::indexOfSubnode(const Node* child) const {
-  return std::find(_subnodeOrder.begin(), _subnodeOrder.end(),
-                   keyForSubnode(child)) -
-         _subnodeOrder.begin();
+  if (child->parent() != this) {
+    throw invalid_argument(
+        "indexOfSubnode() called for node that isn't a subnode");
+  }
+  return child->row();
 }
 
-void BranchNode::removeValuesFromFile(const string& filePath) {
+bool BranchNode::removeValuesFromFile(Symbol filePath) {
+  bool removed = false;
   for (auto itr : _subnodes) {
-    itr.second->removeValuesFromFile(filePath);
+    if (itr.second->removeValuesFromFile(filePath)) removed = true;
   }
+  return removed;
 }
 
 // int BranchNode::columnCount() const {
@@ -116,194 +177,180 @@ void BranchNode::removeValuesFromFile(const string& filePath) {
 QVariant BranchNode::data(int column) const {
   if (column == 0) {
     return QVariant(QString::fromStdString(
-        (parent() != nullptr) ? parent()->keyForSubnode(this) : "CConf Root"));
+        (parent() != nullptr)
+            ? context()->symbols().str(parent()->keyForSubnode(this))
+            : "CConf Root"));
   } else {
     return "";
   }
 }
 
-// #pragma mark LeafNode
+#pragma mark NodeIterator
 
-// void LeafNode::removeValuesFromFile(const string &filePath) {
-//   for (int i = 0; i < _values.size();) {
-//     if (_values[i].filePath() == filePath)
-//       _values.erase(_values.begin() + i);
-//     else
-//       i++;
-//   }
-// }
+NodeIterator::NodeIterator(const BranchNode* root, bool leavesOnly)
+    : _node(root), _root(root), _leavesOnly(leavesOnly) {
+  ++*this;
+}
 
-// void LeafNode::addValue(const QVariant &val, const string &filePath,
-//                         const vector<string> &scope) {
-//   cout << "Added value to keypath '" << keyPath() << "' with scope ";
-//   for (string key : scope) cout << key << ".";
-//   cout << "'; filePath '" << filePath << "'" << endl;
-//   _values.push_back(ValueNode(val, filePath, scope));
-// }
+NodeIterator& NodeIterator::operator++() {
+  do {
+    _advance();
+  } while (_node && _leavesOnly && !_node->isLeafNode());
+  return *this;
+}
 
-// // int LeafNode::columnCount() const {
-// //     return 2;
-// // }
-
-// QVariant LeafNode::data(int column) const {
-//   if (column == 0) {
-//     return QVariant(QString::fromStdString(
-//         (parent() != nullptr) ? parent()->keyForSubnode(this) : "CConf
-//         Root"));
-//   } else if (column == 1) {
-//     const QVariant *val = getValue();
-//     return (val != nullptr) ? *val : QVariant(QString("<null>"));
-//   } else {
-//     throw invalid_argument("Invalid column index for leaf node");
-//   }
-// }
+void NodeIterator::_advance() {
+  const Node* node = _node;
+  if (!node->isLeafNode() && node->childCount() > 0) {
+    _node = ((const BranchNode*)node)->childAt(0);
+    return;
+  }
 
-// const QVariant *LeafNode::getValue(const vector<string> &scope,
-//                                    const string &filePath) const {
-//   //  TODO: optimize this method - probably by maintaining additional data
-//   //  structures to make this search faster
-
-//   bool fileSpecified = filePath.length() > 0;
-
-//   vector<ValueNode *> matchingEntries;
-
-//   for (int maxScopeIndex = scope.size() - 1; maxScopeIndex >= -1;
-//        maxScopeIndex--) {
-//     for (auto entryItr : _values) {
-//       // cout << "Examining entry with fp = " << entryItr.filePath() << ";
-//       value
-//       // = " << entryItr.value().toString().toStdString() << endl;
-//       if (!fileSpecified || entryItr.filePath() == filePath) {
-//         if (entryItr.scope().size() == maxScopeIndex + 1) {
-//           bool found = true;
-//           for (int i = 0; i <= maxScopeIndex; i++) {
-//             if (entryItr.scope()[i] != scope[i]) {
-//               found = false;
-//               break;
-//             }
-//           }
-//           if (found) matchingEntries.push_back(&entryItr);
-//         }
-//       }
-//     }
-//     if (matchingEntries.size() > 0 || (scope.size() == 0 && fileSpecified))
-//       break;
-//   }
-
-//   cout << "at getPath() for '" << keyPath()
-//        << "', value count = " << _values.size() << endl;
-
-//   if (matchingEntries.size() > 0) {
-//     //  sort by file priority
-//     std::sort(matchingEntries.begin(), matchingEntries.end(),
-//               [&](const ValueNode *a, const ValueNode *b) -> bool {
-//                 return context()->priorityOfFile(a->filePath()) >
-//                        context()->priorityOfFile(b->filePath());
-//               });
-
-//     //  value with highest priority
-//     return &(matchingEntries.back()->value());
-
-//   } else {
-//     return nullptr;
-//   }
-// }
+  //  climb until there's a next sibling, without leaving the subtree
+  while (node != _root) {
+    const BranchNode* parent = node->parent();
+    int next = node->row() + 1;
+    if (next < parent->childCount()) {
+      _node = parent->childAt(next);
+      return;
+    }
+    node = parent;
+  }
+  _node = nullptr;
+}
+
+#pragma mark ValueNode
+
+/// Source of ValueNode generations.  Generations are unique across all nodes,
+/// so a node that replaces a deleted one at the same key path can't be
+/// mistaken for it.
+static std::atomic<uint64_t> NextGeneration(1);
+
+void ValueNode::_bumpGeneration() {
+  _generation = NextGeneration++;
+  if (context()) context()->_unpublishedLeaves.insert(this);
+}
+
+bool ValueNode::removeValuesFromFile(Symbol filePath) {
+  if (!_values.removeValuesFromFile(filePath)) return false;
+  _bumpGeneration();
+  return true;
+}
+
+void ValueNode::addValue(const Value* val, Symbol filePath,
+                         const vector<Symbol>& scope) {
+  _values.insert(ScopedValue(val, filePath, scope), context());
+  _bumpGeneration();
+}
+
+bool ValueNode::removeValue(Symbol filePath, const vector<Symbol>& scope) {
+  if (!_values.remove(filePath, scope)) return false;
+  _bumpGeneration();
+  return true;
+}
+
+void ValueNode::rebindValue(const Value* val, Symbol filePath,
+                            const vector<Symbol>& scope) {
+  if (!_values.rebind(ScopedValue(val, filePath, scope))) return;
+  //  the value is the same, so readers see no change, but cached pointers
+  //  still refer to the old one
+  if (context()) context()->_valueCache.invalidateNode(this);
+}
+
+QVariant ValueNode::data(int column) const {
+  if (column == 0) {
+    return QVariant(QString::fromStdString(
+        (parent() != nullptr)
+            ? context()->symbols().str(parent()->keyForSubnode(this))
+            : "CConf Root"));
+  } else if (column == 1) {
+    //  values are only converted for the model, when a view asks for them
+    const Value* val = getValue();
+    return (val != nullptr) ? val->toVariant() : QVariant(QString("<null>"));
+  } else {
+    throw invalid_argument("Invalid column index for leaf node");
+  }
+}
+
+const Value* ValueNode::getValue(const vector<Symbol>& scope,
+                                 Symbol filePath) const {
+  const ScopedValue* best = _values.find(scope, filePath);
+  return best ? &best->value() : nullptr;
+}
 
 #pragma mark Context
 
-/**
- * Remove keys that are merged from the @unhandledKeys set
- */
-void Context::mergeJson(Node* node, const Json::Value& json,
-                        vector<string>& scope, const string& filePath,
-                        set<string>& unhandledKeys,
-                        bool removeValuesForUnhandledKeys) {
+const int Context::FetchBatchSize;
+
+void Context::mergeJson(Node* node, const Tree& tree, Tree::Index treeNode,
+                        vector<Symbol>& scope, Symbol filePath) {
   assert(node != nullptr);
 
-  if (node->isLeafNode() == (json.type() == Json::objectValue)) {
+  if (node->isLeafNode() != tree.isLeaf(treeNode)) {
     throw TypeMismatchError("Attempt to merge a tree and a leaf at key path '" +
                             node->keyPath() + "'.");
   }
 
   if (node->isLeafNode()) {
-    if (removeValuesForUnhandledKeys) node->removeValuesFromFile(filePath);
-
-    ((ValueNode*)node)->addValue(variantValueFromJson(json), filePath, scope);
+    _addFileValue((ValueNode*)node, &tree.value(treeNode), filePath, scope);
   } else {
     BranchNode* parentNode = (BranchNode*)node;
 
-    for (Json::ValueIterator itr = json.begin(); itr != json.end(); itr++) {
-      string jsonKey = itr.key().asString();
+    for (Tree::Index child = tree.firstChild(treeNode);
+         child != Tree::InvalidIndex; child = tree.nextSibling(child)) {
+      Symbol jsonKey = _symbols.intern(tree.key(child));
 
       //  handle scopes
-      if (keyIsJsonScopeSpecifier(jsonKey)) {
-        scope.push_back(extractKeyFromJsonScopeSpecifier(jsonKey));
-        mergeJson(node, json[jsonKey], scope, filePath, unhandledKeys, true);
+      if (tree.node(child).isScope) {
+        scope.push_back(jsonKey);
+        mergeJson(node, tree, child, scope, filePath);
         scope.pop_back();
       } else {
         Node* childNode = (*parentNode)[jsonKey];
         if (!childNode) {
-          if (itr->type() == Json::objectValue) {
-            childNode = new BranchNode(this, parentNode);
-          } else {
-            childNode = new ValueNode(this, parentNode);
-          }
-          parentNode->addSubnode(childNode, jsonKey);
-
-          cout << "Appended new node for key: " << jsonKey << endl;
+          childNode =
+              _createSubnode(parentNode, jsonKey, tree.isLeaf(child));
         }
 
-        unhandledKeys.erase(jsonKey);
-
-        set<string> childUnhandledKeys;
-        if (!childNode->isLeafNode())
-          ((BranchNode*)childNode)->getSubnodeKeys(&childUnhandledKeys);
-        mergeJson(childNode, *itr, scope, filePath, childUnhandledKeys, true);
-      }
-    }
-
-    //  other keys under this branch that this json didn't have anything for
-    if (removeValuesForUnhandledKeys) {
-      for (auto key : unhandledKeys) {
-        (*parentNode)[key]->removeValuesFromFile(filePath);
+        mergeJson(childNode, tree, child, scope, filePath);
       }
     }
   }
 }
 
-QVariant Context::variantValueFromJson(const Json::Value& json) {
+Value Context::valueFromJson(const Json::Value& json) {
   switch (json.type()) {
     case Json::nullValue:
-      return QVariant();
+      return Value();
     case Json::intValue:
-      return QVariant(json.asInt());
+      return json.isInt() ? Value(json.asInt()) : Value(json.asInt64());
     case Json::uintValue:
-      return QVariant(json.asUInt());
+      return json.isUInt() ? Value(json.asUInt()) : Value(json.asUInt64());
     case Json::realValue:
-      return QVariant(json.asDouble());
+      return Value(json.asDouble());
     case Json::stringValue:
-      return QVariant(QString::fromStdString(json.asString()));
+      return Value(json.asString());
     case Json::booleanValue:
-      return QVariant(json.asBool());
+      return Value(json.asBool());
     case Json::arrayValue: {
-      QList<QVariant> lst;
+      vector<Value> lst;
+      lst.reserve(json.size());
       for (auto itr : json) {
-        lst.append(variantValueFromJson(itr));
+        lst.push_back(valueFromJson(itr));
       }
-      return QVariant(lst);
+      return Value(std::move(lst));
     }
     default:
       throw invalid_argument(
-          "Invalid json value passed to variantValueFromJson()");  //  TODO:
-                                                                   //  more info
-      return QVariant();
+          "Invalid json value passed to valueFromJson()");  //  TODO: more info
+      return Value();
   }
 }
 
 bool Context::keyIsJsonScopeSpecifier(const string& key) {
   if (key.length() <= CConfScopeKeyPrefix.length()) return false;
 
-  for (int i = 0; i < CConfScopeKeyPrefix.length(); ++i) {
+  for (size_t i = 0; i < CConfScopeKeyPrefix.length(); ++i) {
     if (key[i] != CConfScopeKeyPrefix[i]) return false;
   }
   return true;
@@ -313,42 +360,531 @@ string Context::extractKeyFromJsonScopeSpecifier(const string& scopeSpec) {
   return scopeSpec.substr(CConfScopeKeyPrefix.length());
 }
 
-Context::Context() {
+Context::Context()
+    : _resetting(false),
+      _coalescing(false),
+      _reloadInProgress(false),
+      _statsOut(&cerr),
+      _snapshotVersion(0),
+      _structureGeneration(0) {
   QObject::connect(&_fsWatcher, &QFileSystemWatcher::fileChanged, this,
-                   &Context::fileChanged);
-
-  _rootNode = new BranchNode(this);
+                   &Context::scheduleReload);
+  _reloadTimer.setSingleShot(true);
+  _reloadTimer.setInterval(DefaultReloadDelayMs);
+  QObject::connect(&_reloadTimer, &QTimer::timeout,
+                   [this]() { _startReloadWorker(); });
+  QObject::connect(&_statsTimer, &QTimer::timeout,
+                   [this]() { *_statsOut << _stats.toJson() << endl; });
+
+  _rootNode = _branchNodes.create(this);
+  _publishSnapshot();
 }
 
 void Context::fileChanged(const QString& filePath) {
-  cout << "Context file changed: " << filePath.toStdString() << endl;
+  string path = filePath.toStdString();
+  if (!containsFile(path)) return;
+  Symbol fileSym = _symbols.find(path);
+  _stats.increment(ContextStats::Reloads);
+
+  Tree tree;
+  try {
+    tree = _parseFile(path);
+  } catch (runtime_error& e) {
+    //  editors often save in several steps, so a failed parse here usually
+    //  just means we'll get another change notification shortly
+    cerr << "Failed to reload file '" << path << "': " << e.what() << endl;
+    return;
+  }
+
+  _discardEdits(path);
+  {
+    LatencyHistogram::Timer timer(
+        &_stats.histogram(ContextStats::ReloadTime));
+    _reloadFile(fileSym, path, tree);
+  }
+  _publishSnapshot();
+}
+
+Context::~Context() {
+  //  a reload may still be parsing.  Its results are dropped along with the
+  //  queued call that would have applied them.
+  if (_reloadWorker.joinable()) _reloadWorker.join();
+
+  //  same for async loads, which are reported as cancelled
+  for (shared_ptr<AsyncLoad>& load : _asyncLoads) {
+    if (load->worker.joinable()) load->worker.join();
+    LoadResult result;
+    result.path = load->file.path;
+    result.status = LoadResult::Cancelled;
+    result.error = "the context was destroyed";
+    load->promise.set_value(result);
+  }
+
+  _destroyNode(_rootNode);
+}
+
+const int Context::DefaultReloadDelayMs;
+const int Context::MaxReloadRetries;
+
+void Context::scheduleReload(const QString& filePath) {
+  string path = filePath.toStdString();
+  if (!containsFile(path)) return;
+
+  _pendingReloads[path] = 0;
+  //  restarting the timer coalesces a burst of writes into one reload
+  if (!_reloadInProgress) _reloadTimer.start();
+}
+
+void Context::setReloadDelay(int delayMs) {
+  _reloadTimer.setInterval(delayMs);
+}
+
+void Context::_startReloadWorker() {
+  vector<string> paths;
+  for (auto itr = _pendingReloads.begin(); itr != _pendingReloads.end();) {
+    const string& path = itr->first;
+    QString qpath = QString::fromStdString(path);
+
+    //  Editors that save by writing a new file and renaming it over the old
+    //  one make the watcher drop the path.  Watch the new file instead, or
+    //  wait for it to show up if the rename hasn't happened yet.
+    if (!QFileInfo(qpath).exists()) {
+      if (++itr->second > MaxReloadRetries) {
+        cerr << "File '" << path << "' disappeared, no longer reloading it"
+             << endl;
+        itr = _pendingReloads.erase(itr);
+      } else {
+        ++itr;
+      }
+      continue;
+    }
+    if (!_fsWatcher.files().contains(qpath)) _fsWatcher.addPath(qpath);
+
+    paths.push_back(path);
+    itr = _pendingReloads.erase(itr);
+  }
+  if (!_pendingReloads.empty()) _reloadTimer.start();
+  if (paths.empty()) return;
+
+  if (_reloadWorker.joinable()) _reloadWorker.join();
+  _reloadInProgress = true;
+  _reloadTimer.stop();
+
+  _reloadWorker = std::thread([this, paths]() {
+    auto parsed = make_shared<vector<ParsedFile>>(paths.size());
+    for (size_t i = 0; i < paths.size(); i++) {
+      ParsedFile& file = (*parsed)[i];
+      file.path = paths[i];
+      try {
+        file.tree = _parseFile(file.path);
+      } catch (runtime_error& e) {
+        file.error = e.what();
+      }
+    }
+
+    QMetaObject::invokeMethod(this, [this, parsed]() { _applyReloads(parsed); },
+                              Qt::QueuedConnection);
+  });
+}
+
+void Context::_applyReloads(shared_ptr<vector<ParsedFile>> parsed) {
+  if (_reloadWorker.joinable()) _reloadWorker.join();
+  _reloadInProgress = false;
+
+  bool changed = false;
+  for (ParsedFile& file : *parsed) {
+    //  removed while it was being parsed
+    if (!containsFile(file.path)) continue;
+
+    if (!file.error.empty()) {
+      //  editors often save in several steps, so a failed parse here usually
+      //  just means we'll get another change notification shortly
+      cerr << "Failed to reload file '" << file.path << "': " << file.error
+           << endl;
+      continue;
+    }
+
+    _stats.increment(ContextStats::Reloads);
+    _discardEdits(file.path);
+    LatencyHistogram::Timer timer(
+        &_stats.histogram(ContextStats::ReloadTime));
+    _reloadFile(_symbols.find(file.path), file.path, file.tree);
+    changed = true;
+  }
+  if (changed) _publishSnapshot();
+
+  //  changes that came in while parsing
+  if (!_pendingReloads.empty()) _reloadTimer.start();
+}
+
+void Context::_collectLeaves(const Tree& tree, Tree::Index index,
+                             vector<Symbol>* keyPath, vector<Symbol>* scope,
+                             map<LeafKey, Tree::Index>* leavesOut) {
+  if (tree.isLeaf(index)) {
+    (*leavesOut)[make_pair(*keyPath, *scope)] = index;
+    return;
+  }
+
+  for (Tree::Index child = tree.firstChild(index); child != Tree::InvalidIndex;
+       child = tree.nextSibling(child)) {
+    vector<Symbol>* path = tree.node(child).isScope ? scope : keyPath;
+    path->push_back(_symbols.intern(tree.key(child)));
+    _collectLeaves(tree, child, keyPath, scope, leavesOut);
+    path->pop_back();
+  }
+}
+
+void Context::_reloadFile(Symbol filePath, const string& path, Tree& newTree) {
+  try {
+    _applyFileTree(filePath, path, newTree);
+  } catch (const TypeMismatchError& e) {
+    _stats.increment(ContextStats::TypeMismatches);
+    cerr << "Type mismatch when reloading file '" << path
+         << "', it was removed from the context: " << e.what() << endl;
+    _unregisterFile(path);
+  }
+}
+
+void Context::_applyFileTree(Symbol filePath, const string& path,
+                             Tree& newTree) {
+  Tree& oldTree = _fileTrees[path];
+
+  map<LeafKey, Tree::Index> oldLeaves, newLeaves;
+  vector<Symbol> keyPath, scope;
+  if (!oldTree.empty()) {
+    _collectLeaves(oldTree, oldTree.root(), &keyPath, &scope, &oldLeaves);
+  }
+  _collectLeaves(newTree, newTree.root(), &keyPath, &scope, &newLeaves);
+
+  //  values the file no longer defines
+  for (auto& old : oldLeaves) {
+    if (newLeaves.count(old.first)) continue;
+
+    Node* node = _nodeForKeySymbols(old.first.first);
+    if (!node || !node->isLeafNode()) continue;
+    ValueNode* leaf = (ValueNode*)node;
+    if (leaf->removeValue(filePath, old.first.second)) {
+      _leafValuesChanged(leaf);
+      _pruneIfEmpty(leaf);
+    }
+  }
+
+  //  values that changed or are new.  Note that the new values point into
+  //  @newTree's value storage, which survives the swap below.
+  vector<const pair<const LeafKey, Tree::Index>*> inserted;
+  for (auto& entry : newLeaves) {
+    auto old = oldLeaves.find(entry.first);
+    Node* node = nullptr;
+    if (old != oldLeaves.end()) node = _nodeForKeySymbols(entry.first.first);
+    if (!node || !node->isLeafNode()) {
+      inserted.push_back(&entry);
+      continue;
+    }
+
+    ValueNode* leaf = (ValueNode*)node;
+    const Value* value = &newTree.value(entry.second);
+    if (*value == oldTree.value(old->second)) {
+      leaf->rebindValue(value, filePath, entry.first.second);
+    } else {
+      _addFileValue(leaf, value, filePath, entry.first.second);
+    }
+  }
+
+  for (auto entry : inserted) {
+    ValueNode* leaf = _leafForKeySymbols(entry->first.first);
+    _addFileValue(leaf, &newTree.value(entry->second), filePath,
+                  entry->first.second);
+  }
+
+  //  the old tree is released when @newTree goes out of scope in the caller
+  std::swap(oldTree, newTree);
+}
+
+Node* Context::_nodeForKeySymbols(const vector<Symbol>& keyPath) {
+  Node* node = _rootNode;
+  for (Symbol key : keyPath) {
+    if (node->isLeafNode()) return nullptr;
+    node = (*(BranchNode*)node)[key];
+    if (!node) return nullptr;
+  }
+  return node;
+}
+
+ValueNode* Context::_leafForKeySymbols(const vector<Symbol>& keyPath) {
+  Node* node = _rootNode;
+  for (size_t i = 0; i < keyPath.size(); i++) {
+    if (node->isLeafNode()) break;
+
+    BranchNode* branch = (BranchNode*)node;
+    node = (*branch)[keyPath[i]];
+    if (!node) {
+      node = _createSubnode(branch, keyPath[i], i == keyPath.size() - 1);
+    }
+  }
+
+  if (!node->isLeafNode() || _nodeForKeySymbols(keyPath) != node) {
+    throw TypeMismatchError("Attempt to merge a tree and a leaf at key path '" +
+                            node->keyPath() + "'.");
+  }
+  return (ValueNode*)node;
+}
+
+Node* Context::_createSubnode(BranchNode* parent, Symbol key, bool isLeaf) {
+  //  Rows past the fetched ones aren't known to views yet, so they're only
+  //  told about the new row if it lands inside that range - or appends to a
+  //  branch they've already fetched completely.  Anything else is left for
+  //  fetchMore().
+  int row = parent->rowForNewSubnode(key);
+  int fetched = parent->_fetchedCount;
+  bool exposed =
+      row < fetched ||
+      (row == fetched && fetched == parent->childCount() && fetched > 0);
+  bool notify = exposed && !_resetting && _isVisible(parent);
+  if (notify) beginInsertRows(_indexForNode(parent), row, row);
+
+  Node* child;
+  if (isLeaf) {
+    child = _valueNodes.create(this, parent);
+  } else {
+    child = _branchNodes.create(this, parent);
+  }
+  parent->addSubnode(child, key);
+  _keyIndex[key].push_back(child);
+  if (exposed) parent->_fetchedCount++;
+  _structureGeneration++;
+  _stats.increment(ContextStats::NodesCreated);
+
+  if (notify) endInsertRows();
+  return child;
+}
+
+void Context::_pruneIfEmpty(Node* node) {
+  while (node != _rootNode) {
+    bool empty = node->isLeafNode() ? !((ValueNode*)node)->hasValues()
+                                    : node->childCount() == 0;
+    if (!empty) return;
+
+    BranchNode* parent = node->parent();
+    _removeSubnode(parent, node);
+    node = parent;
+  }
+}
+
+void Context::_removeSubnode(BranchNode* parent, Node* child) {
+  int row = child->row();
+  bool exposed = row < parent->_fetchedCount;
+  bool notify = exposed && !_resetting && _isVisible(parent);
+  if (notify) beginRemoveRows(_indexForNode(parent), row, row);
+  _destroyNode(parent->removeSubnode(child->key()));
+  if (exposed) parent->_fetchedCount--;
+  _stats.increment(ContextStats::NodesRemoved);
+  if (notify) endRemoveRows();
+}
+
+QModelIndex Context::_indexForNode(Node* node, int column) const {
+  if (node == _rootNode) return QModelIndex();
+  return createIndex(node->row(), column, node);
+}
+
+bool Context::_isVisible(const Node* node) const {
+  for (; node != _rootNode; node = node->parent()) {
+    if (node->row() >= node->parent()->_fetchedCount) return false;
+  }
+  return true;
+}
+
+void Context::_addFileValue(ValueNode* leaf, const Value* value,
+                            Symbol filePath, const vector<Symbol>& scope) {
+  leaf->addValue(value, filePath, scope);
+  _fileLeaves[filePath].insert(leaf);
+  _leafValuesChanged(leaf);
+}
+
+void Context::_removeValuesFromFile(Symbol filePath) {
+  auto itr = _fileLeaves.find(filePath);
+  if (itr == _fileLeaves.end()) return;
+  unordered_set<ValueNode*> leaves;
+  leaves.swap(itr->second);
+  _fileLeaves.erase(itr);
+  _removeValuesFromLeaves(filePath, leaves);
+}
+
+void Context::_removeValuesFromLeaves(Symbol filePath,
+                                      const unordered_set<ValueNode*>& leaves) {
+  //  Pruning a leaf only removes ancestors that have no other subnodes, so it
+  //  never deletes a leaf that's still waiting in @leaves.
+  for (ValueNode* leaf : leaves) {
+    if (!leaf->removeValuesFromFile(filePath)) continue;
+    if (leaf->hasValues()) {
+      _leafValuesChanged(leaf);
+    } else {
+      _pruneIfEmpty(leaf);
+    }
+  }
+}
+
+void Context::_leafValuesChanged(ValueNode* leaf) {
+  if (_resetting) return;
+  if (_coalescing) {
+    _changedLeaves.insert(leaf);
+    return;
+  }
+  if (!_isVisible(leaf)) return;
+  QModelIndex idx = _indexForNode(leaf, 1);
+  emit dataChanged(idx, idx);
 }
 
 void Context::addFile(const string& path) {
-  if (containsFile(path)) {
+  _checkCanAddFile(path);
+
+  //  note: throws an exception on failure
+  Tree tree = _parseFile(path);
+
+  try {
+    _mergeFile(path, tree);
+  } catch (const TypeMismatchError&) {
+    _publishSnapshot();
+    throw;
+  }
+  _publishSnapshot();
+}
+
+/// Calls @fn for every index below @count on a pool of threads
+static void ParallelFor(size_t count, const function<void(size_t)>& fn) {
+  atomic<size_t> next(0);
+  auto work = [&]() {
+    for (size_t i = next++; i < count; i = next++) fn(i);
+  };
+
+  size_t threadCount =
+      min<size_t>(count, max(1u, std::thread::hardware_concurrency()));
+  vector<std::thread> workers;
+  for (size_t i = 1; i < threadCount; i++) workers.emplace_back(work);
+  work();
+  for (std::thread& worker : workers) worker.join();
+}
+
+void Context::addFiles(const vector<string>& paths) {
+  //  parse everything up front, in parallel.  Errors are held on to so they
+  //  can be raised at the point the sequential version would hit them.
+  vector<Tree> trees(paths.size());
+  vector<exception_ptr> errors(paths.size());
+
+  //  with a startup cache the files are read and stamped first, and only
+  //  parsed (from what was read) if the cache doesn't match them
+  bool useCache = !_startupCachePath.empty() && _configFiles.empty();
+  vector<FileStamp> stamps(useCache ? paths.size() : 0);
+  vector<string> contents(stamps.size());
+  bool cacheHit = false;
+  if (useCache) {
+    ParallelFor(paths.size(), [&](size_t i) {
+      try {
+        stamps[i] = StampFile(paths[i], &contents[i]);
+      } catch (...) {
+        errors[i] = current_exception();
+      }
+    });
+    bool readAll = true;
+    for (const exception_ptr& error : errors) readAll = readAll && !error;
+    cacheHit = readAll && LoadStartupCache(_startupCachePath, stamps, &trees);
+    _stats.increment(cacheHit ? ContextStats::StartupCacheHits
+                              : ContextStats::StartupCacheMisses);
+  }
+
+  if (!cacheHit) {
+    ParallelFor(paths.size(), [&](size_t i) {
+      if (errors[i]) return;
+      try {
+        trees[i] = _parseFile(paths[i], useCache ? &contents[i] : nullptr);
+      } catch (...) {
+        errors[i] = current_exception();
+      }
+    });
+  }
+
+  //  merging touches the tree and emits model signals, so it happens here, in
+  //  priority order
+  try {
+    for (size_t i = 0; i < paths.size(); i++) {
+      _checkCanAddFile(paths[i]);
+      if (errors[i]) rethrow_exception(errors[i]);
+      _mergeFile(paths[i], trees[i]);
+    }
+  } catch (...) {
+    _publishSnapshot();
+    throw;
+  }
+  _publishSnapshot();
+
+  if (useCache && !cacheHit) {
+    vector<const Tree*> merged;
+    for (const string& path : paths) merged.push_back(&_fileTrees[path]);
+    try {
+      WriteStartupCache(_startupCachePath, stamps, merged);
+    } catch (runtime_error& e) {
+      cerr << e.what() << endl;
+    }
+  }
+}
+
+void Context::setStartupCache(const string& cachePath) {
+  _startupCachePath = cachePath;
+}
+
+void Context::_checkCanAddFile(const string& path) const {
+  if (_image) {
+    throw invalid_argument(
+        "Files can't be added to a context serving an image: '" + path + "'");
+  }
+  if (indexOfFile(path) != -1) {
     throw invalid_argument(
         "The given file is already present in the context: '" + path + "'");
   }
+}
 
-  //  note: throws an exception on failure
-  Json::Value tree = readFile(path);
+void Context::_mergeFile(const string& path, Tree& parsed) {
+  Tree& tree = _fileTrees[path] = std::move(parsed);
+
+  //  the file has to be registered before merging so its values can be ordered
+  //  by priority as they're inserted
+  Symbol fileSym = _symbols.intern(path);
+  _fileIndices[fileSym] = _configFiles.size();
+  _configFiles.push_back(path);
+
+  //  leaves the file had values on before, so the ones it no longer has
+  //  anything for can be cleaned up afterwards
+  unordered_set<ValueNode*> previousLeaves;
+  previousLeaves.swap(_fileLeaves[fileSym]);
 
   try {
-    vector<string> scope;
-    set<string> rootKeys;
-    _rootNode->getSubnodeKeys(&rootKeys);
-    mergeJson(_rootNode, tree, scope, path, rootKeys, true);
-  } catch (TypeMismatchError e) {
+    LatencyHistogram::Timer timer(&_stats.histogram(ContextStats::MergeTime));
+    vector<Symbol> scope;
+    mergeJson(_rootNode, tree, tree.root(), scope, fileSym);
+  } catch (const TypeMismatchError&) {
+    _stats.increment(ContextStats::TypeMismatches);
     cerr << "Encountered a type mismatch when trying to load file: " << path
          << endl;
     cerr << "  Unloading all values from this file and rethrowing.  Correct "
             "and try again."
          << endl;
-    // TODO: unload values from the failed file
-    throw e;
+    _fileLeaves[fileSym].insert(previousLeaves.begin(), previousLeaves.end());
+    _removeValuesFromFile(fileSym);
+    _configFiles.pop_back();
+    _fileIndices.erase(fileSym);
+    _fileTrees.erase(path);
+    throw;
   }
 
-  _configFiles.push_back(path);
+  const unordered_set<ValueNode*>& mergedLeaves = _fileLeaves[fileSym];
+  for (auto itr = previousLeaves.begin(); itr != previousLeaves.end();) {
+    if (mergedLeaves.count(*itr)) {
+      itr = previousLeaves.erase(itr);
+    } else {
+      ++itr;
+    }
+  }
+  _removeValuesFromLeaves(fileSym, previousLeaves);
+
   _fsWatcher.addPath(QString::fromStdString(path));
 }
 
@@ -363,6 +899,39 @@ Json::Value Context::readFile(const string& filePath) {
   return json;
 }
 
+Tree Context::_parseFile(const string& filePath, const string* contents) {
+  LatencyHistogram::Timer timer(&_stats.histogram(ContextStats::ParseTime));
+  try {
+    Tree tree;
+    if (contents) {
+      istringstream in(*contents);
+      tree = ReadJsonStream(in);
+    } else {
+      tree = readFileTree(filePath);
+    }
+    _stats.increment(ContextStats::FilesParsed);
+    return tree;
+  } catch (runtime_error&) {
+    _stats.increment(ContextStats::ParseErrors);
+    throw;
+  }
+}
+
+void Context::dumpStatsEvery(int intervalMs, ostream* out) {
+  _statsOut = out;
+  if (intervalMs > 0) {
+    _statsTimer.start(intervalMs);
+  } else {
+    _statsTimer.stop();
+  }
+}
+
+Tree Context::readFileTree(const string& filePath) {
+  ifstream doc(filePath);
+  if (!doc) throw runtime_error("failed to open file: " + filePath);
+  return ReadJsonStream(doc);
+}
+
 bool Context::containsFile(const string& path) {
   return indexOfFile(path) != -1;
 }
@@ -374,14 +943,1058 @@ void Context::removeFile(const string& filePath) {
             "context: "
          << filePath << endl;
   } else {
-    _configFiles.erase(_configFiles.begin() + idx);
-    _fsWatcher.removePath(QString::fromStdString(filePath));
+    LatencyHistogram::Timer timer(&_stats.histogram(ContextStats::RemoveTime));
+    _unregisterFile(filePath);
+    //  only republishes the leaves the file had values on
+    _publishSnapshot();
+  }
+}
+
+void Context::_unregisterFile(const string& filePath) {
+  int idx = indexOfFile(filePath);
+  Symbol fileSym = _symbols.find(filePath);
+  _removeValuesFromFile(fileSym);
+  _dirtyFiles.erase(fileSym);
+  _configFiles.erase(_configFiles.begin() + idx);
+  _fileIndices.erase(fileSym);
+  _fileTrees.erase(filePath);
+  for (size_t i = idx; i < _configFiles.size(); i++) {
+    _fileIndices[_symbols.find(_configFiles[i])] = (int)i;
+  }
+  _fsWatcher.removePath(QString::fromStdString(filePath));
+}
+
+#pragma mark Async loading
+
+future<LoadResult> Context::addFileAsync(const string& path) {
+  shared_ptr<AsyncLoad> load = make_shared<AsyncLoad>();
+  load->file.path = path;
+  future<LoadResult> result = load->promise.get_future();
+  _asyncLoads.push_back(load);
+
+  //  the worker only touches its own load, which _asyncLoads keeps alive
+  //  until the worker has been joined
+  AsyncLoad* parsing = load.get();
+  load->worker = std::thread([this, parsing]() {
+    try {
+      parsing->file.tree = _parseFile(parsing->file.path);
+    } catch (runtime_error& e) {
+      parsing->file.error = e.what();
+    }
+    parsing->ready.store(true, memory_order_release);
+
+    QMetaObject::invokeMethod(this, [this]() { _applyAsyncLoads(); },
+                              Qt::QueuedConnection);
+  });
+  return result;
+}
+
+future<LoadResult> Context::removeFileAsync(const string& filePath) {
+  shared_ptr<AsyncLoad> load = make_shared<AsyncLoad>();
+  load->remove = true;
+  load->file.path = filePath;
+  load->ready.store(true, memory_order_release);
+  future<LoadResult> result = load->promise.get_future();
+  _asyncLoads.push_back(load);
+
+  QMetaObject::invokeMethod(this, [this]() { _applyAsyncLoads(); },
+                            Qt::QueuedConnection);
+  return result;
+}
+
+void Context::_applyAsyncLoads() {
+  while (!_asyncLoads.empty() &&
+         _asyncLoads.front()->ready.load(memory_order_acquire)) {
+    shared_ptr<AsyncLoad> load = _asyncLoads.front();
+    _asyncLoads.pop_front();
+    if (load->worker.joinable()) load->worker.join();
+
+    LoadResult result = _applyAsyncLoad(*load);
+    load->promise.set_value(result);
+    emit fileLoadFinished(result);
+  }
+}
+
+LoadResult Context::_applyAsyncLoad(AsyncLoad& load) {
+  LoadResult result;
+  result.path = load.file.path;
+  const string& path = load.file.path;
+  try {
+    if (load.remove) {
+      if (!containsFile(path)) {
+        throw invalid_argument("The given file isn't in the context: '" +
+                               path + "'");
+      }
+      removeFile(path);
+      return result;
+    }
+
+    _checkCanAddFile(path);
+    if (!load.file.error.empty()) {
+      result.status = LoadResult::ParseError;
+      result.error = load.file.error;
+      return result;
+    }
+    try {
+      _mergeFile(path, load.file.tree);
+    } catch (TypeMismatchError&) {
+      _publishSnapshot();
+      throw;
+    }
+    _publishSnapshot();
+  } catch (TypeMismatchError& e) {
+    result.status = LoadResult::TypeMismatch;
+    result.error = e.what();
+  } catch (invalid_argument& e) {
+    result.status = LoadResult::InvalidArgument;
+    result.error = e.what();
   }
+  return result;
+}
+
+#pragma mark Write-back
+
+static vector<string> SplitKeyPath(const string& keyPath) {
+  vector<string> keys;
+  size_t start = 0;
+  while (true) {
+    size_t end = keyPath.find('.', start);
+    if (end == string::npos) {
+      keys.push_back(keyPath.substr(start));
+      return keys;
+    }
+    keys.push_back(keyPath.substr(start, end - start));
+    start = end + 1;
+  }
+}
+
+/// Converts a Tree node back to json, scope keys included
+static Json::Value JsonFromTree(const Tree& tree, Tree::Index index) {
+  if (tree.isLeaf(index)) return Context::jsonFromValue(tree.value(index));
+
+  Json::Value json(Json::objectValue);
+  for (Tree::Index child = tree.firstChild(index); child != Tree::InvalidIndex;
+       child = tree.nextSibling(child)) {
+    if (tree.node(child).isScope) {
+      json[CConfScopeKeyPrefix + tree.key(child)] = JsonFromTree(tree, child);
+    } else {
+      json[tree.key(child)] = JsonFromTree(tree, child);
+    }
+  }
+  return json;
+}
+
+Json::Value Context::jsonFromValue(const Value& value) {
+  switch (value.type()) {
+    case Value::Bool:
+      return Json::Value(value.toBool());
+    case Value::Int:
+      return Json::Value((Json::Int64)value.toInt());
+    case Value::UInt:
+      return Json::Value((Json::UInt64)value.toInt());
+    case Value::Double:
+      return Json::Value(value.toDouble());
+    case Value::String:
+      return Json::Value(value.toString());
+    case Value::List: {
+      Json::Value lst(Json::arrayValue);
+      for (size_t i = 0; i < value.listSize(); i++) {
+        lst.append(jsonFromValue(value.listAt(i)));
+      }
+      return lst;
+    }
+    default:
+      return Json::Value();
+  }
+}
+
+Json::Value Context::extractJson(const string& filePath) const {
+  auto itr = _fileTrees.find(filePath);
+  if (itr == _fileTrees.end()) {
+    throw invalid_argument("The given file isn't in the context: '" +
+                           filePath + "'");
+  }
+  const Tree& tree = itr->second;
+  if (tree.empty()) return Json::Value(Json::objectValue);
+  return JsonFromTree(tree, tree.root());
+}
+
+void Context::setValue(const string& keyPath, const Value& value,
+                       const string& filePath, const vector<string>& scope) {
+  Transaction transaction = beginTransaction();
+  transaction.set(keyPath, value, filePath, scope);
+  transaction.commit();
+}
+
+bool Context::removeValue(const string& keyPath, const string& filePath,
+                          const vector<string>& scope) {
+  Transaction transaction = beginTransaction();
+  transaction.remove(keyPath, filePath, scope);
+  return transaction.commit() > 0;
+}
+
+void Context::_checkCanSetLeaf(const vector<string>& keyPath) const {
+  const Node* node = _rootNode;
+  for (size_t i = 0; i < keyPath.size(); i++) {
+    Symbol key = _symbols.find(keyPath[i]);
+    if (key == InvalidSymbol) return;
+    node = ((const BranchNode*)node)->subnode(key);
+    if (!node) return;
+
+    bool last = i + 1 == keyPath.size();
+    if (node->isLeafNode() != last) {
+      throw TypeMismatchError(
+          "Attempt to merge a tree and a leaf at key path '" +
+          node->keyPath() + "'.");
+    }
+  }
+}
+
+void Context::_discardEdits(const string& path) {
+  if (_dirtyFiles.erase(_symbols.find(path))) {
+    cerr << "File '" << path << "' changed on disk, discarding its unsaved "
+            "edits"
+         << endl;
+  }
+}
+
+#pragma mark Transactions
+
+const size_t Context::TransactionResetThreshold;
+
+void Context::Transaction::set(const string& keyPath, const Value& value,
+                               const string& filePath,
+                               const vector<string>& scope) {
+  _edits.push_back(Edit{false, keyPath, value, filePath, scope});
+}
+
+void Context::Transaction::remove(const string& keyPath,
+                                  const string& filePath,
+                                  const vector<string>& scope) {
+  _edits.push_back(Edit{true, keyPath, Value(), filePath, scope});
+}
+
+size_t Context::Transaction::commit() {
+  size_t applied = _context->_commit(_edits);
+  _edits.clear();
+  return applied;
+}
+
+size_t Context::_commit(const vector<Transaction::Edit>& edits) {
+  //  Everything is checked against copies of the files' trees first, so a
+  //  TypeMismatchError leaves the context exactly as it was.
+  struct EditedFile {
+    Tree tree;
+    bool removedLeaves;
+    bool changed;
+  };
+  map<string, EditedFile> files;
+  vector<vector<string>> setPaths;
+  size_t applied = 0;
+  for (const Transaction::Edit& edit : edits) {
+    auto file = files.find(edit.filePath);
+    if (file == files.end()) {
+      auto current = _fileTrees.find(edit.filePath);
+      if (current == _fileTrees.end()) {
+        throw invalid_argument("The given file isn't in the context: '" +
+                               edit.filePath + "'");
+      }
+      file = files.insert(make_pair(edit.filePath,
+                                    EditedFile{current->second, false, false}))
+                 .first;
+    }
+    Tree& tree = file->second.tree;
+    vector<string> keys = SplitKeyPath(edit.keyPath);
+    Tree::Index leaf = tree.findLeaf(keys, edit.scope);
+
+    if (edit.remove) {
+      //  objects left empty are harmless - they don't create nodes
+      if (leaf != Tree::InvalidIndex) {
+        tree.removeLeaf(leaf);
+        file->second.removedLeaves = true;
+        file->second.changed = true;
+        applied++;
+      }
+    } else {
+      _checkCanSetLeaf(keys);
+      if (leaf != Tree::InvalidIndex) {
+        if (!(tree.value(leaf) == edit.value)) {
+          tree.setValue(leaf, edit.value);
+          file->second.changed = true;
+        }
+      } else if (tree.addLeaf(keys, edit.scope, edit.value) ==
+                 Tree::InvalidIndex) {
+        throw TypeMismatchError("Attempt to set '" + edit.keyPath +
+                                "' across a leaf or over a tree in file '" +
+                                edit.filePath + "'.");
+      } else {
+        file->second.changed = true;
+      }
+      setPaths.push_back(keys);
+      applied++;
+    }
+  }
+
+  //  edits in different files can still disagree on whether a key path is a
+  //  leaf: after sorting, a leaf path is directly followed by any path below
+  //  it
+  sort(setPaths.begin(), setPaths.end());
+  for (size_t i = 1; i < setPaths.size(); i++) {
+    const vector<string>& a = setPaths[i - 1];
+    const vector<string>& b = setPaths[i];
+    if (a.size() < b.size() && equal(a.begin(), a.end(), b.begin())) {
+      string keyPath = a.front();
+      for (size_t k = 1; k < a.size(); k++) keyPath += "." + a[k];
+      throw TypeMismatchError("Attempt to set values at both '" + keyPath +
+                              "' and below it in one transaction.");
+    }
+  }
+
+  //  files the edits leave as they were stay clean
+  for (auto itr = files.begin(); itr != files.end();) {
+    if (itr->second.changed) {
+      ++itr;
+    } else {
+      itr = files.erase(itr);
+    }
+  }
+  if (files.empty()) return applied;
+
+  //  the nodes the edited files need that don't exist yet
+  set<vector<Symbol>> missing;
+  for (auto& file : files) {
+    //  drops the storage of removed leaves
+    if (file.second.removedLeaves) {
+      file.second.tree = file.second.tree.compacted();
+    }
+    const Tree& tree = file.second.tree;
+
+    map<LeafKey, Tree::Index> leaves;
+    vector<Symbol> keyPath, scope;
+    _collectLeaves(tree, tree.root(), &keyPath, &scope, &leaves);
+    for (auto& leaf : leaves) {
+      if (!_nodeForKeySymbols(leaf.first.first)) {
+        missing.insert(leaf.first.first);
+      }
+    }
+  }
+
+  //  Small batches tell views exactly which rows were inserted and changed.
+  //  Past the threshold that costs more than letting views start over.
+  bool reset = edits.size() + missing.size() > TransactionResetThreshold;
+  if (reset) {
+    beginResetModel();
+    _resetting = true;
+  } else {
+    _coalescing = true;
+  }
+
+  _createNodes(missing);
+  //  Each file's old tree ends up in @files as it's swapped out, so if
+  //  applying a file fails the ones before it can be put back.
+  size_t attempted = 0;
+  try {
+    for (auto& entry : files) {
+      attempted++;
+      _applyFileTree(_symbols.find(entry.first), entry.first,
+                     entry.second.tree);
+    }
+  } catch (...) {
+    vector<string> paths;
+    vector<Tree*> oldTrees;
+    for (auto& entry : files) {
+      if (paths.size() == attempted) break;
+      paths.push_back(entry.first);
+      oldTrees.push_back(&entry.second.tree);
+    }
+    _restoreFiles(paths, oldTrees, attempted - 1, missing);
+    _endCommitSignals(reset);
+    _publishSnapshot();
+    throw;
+  }
+  for (auto& entry : files) _dirtyFiles.insert(_symbols.find(entry.first));
+
+  _endCommitSignals(reset);
+  _publishSnapshot();
+  return applied;
+}
+
+void Context::_endCommitSignals(bool reset) {
+  if (reset) {
+    _resetting = false;
+    _changedLeaves.clear();
+    endResetModel();
+  } else {
+    _coalescing = false;
+    _emitChangedLeaves();
+  }
+}
+
+void Context::_restoreFiles(const vector<string>& paths,
+                            const vector<Tree*>& oldTrees, size_t applied,
+                            const set<vector<Symbol>>& created) {
+  for (size_t i = 0; i < paths.size(); i++) {
+    _removeValuesFromFile(_symbols.find(paths[i]));
+    //  the new tree stays alive in @oldTrees until the caller is done
+    if (i < applied) std::swap(_fileTrees[paths[i]], *oldTrees[i]);
+  }
+  for (const vector<Symbol>& keyPath : created) {
+    Node* node = _nodeForKeySymbols(keyPath);
+    if (node) _pruneIfEmpty(node);
+  }
+
+  //  the old trees merged before, so they merge again
+  for (const string& path : paths) {
+    const Tree& tree = _fileTrees[path];
+    if (tree.empty()) continue;
+    vector<Symbol> scope;
+    mergeJson(_rootNode, tree, tree.root(), scope, _symbols.find(path));
+  }
+}
+
+void Context::_createNodes(const set<vector<Symbol>>& keyPaths) {
+  //  one level at a time, so that each branch gets all of its new subnodes at
+  //  once
+  for (size_t depth = 0;; depth++) {
+    map<BranchNode*, map<Symbol, bool>> additions;
+    bool deeper = false;
+    for (const vector<Symbol>& keyPath : keyPaths) {
+      if (keyPath.size() <= depth) continue;
+      deeper = deeper || keyPath.size() > depth + 1;
+
+      Node* parent = _nodeForKeySymbols(
+          vector<Symbol>(keyPath.begin(), keyPath.begin() + depth));
+      if (!parent || parent->isLeafNode()) continue;
+      BranchNode* branch = (BranchNode*)parent;
+      if (!(*branch)[keyPath[depth]]) {
+        additions[branch][keyPath[depth]] = depth + 1 == keyPath.size();
+      }
+    }
+
+    for (auto& entry : additions) {
+      _createSubnodes(entry.first, entry.second);
+    }
+    if (!deeper) return;
+  }
+}
+
+void Context::_createSubnodes(BranchNode* parent,
+                              const map<Symbol, bool>& keys) {
+  vector<pair<Symbol, Node*>> added;
+  for (auto& key : keys) {
+    Node* child = key.second ? (Node*)_valueNodes.create(this, parent)
+                             : (Node*)_branchNodes.create(this, parent);
+    added.push_back(make_pair(key.first, child));
+    _keyIndex[key.first].push_back(child);
+  }
+  const SymbolTable& symbols = _symbols;
+  sort(added.begin(), added.end(),
+       [&](const pair<Symbol, Node*>& a, const pair<Symbol, Node*>& b) {
+         return symbols.str(a.first) < symbols.str(b.first);
+       });
+  _structureGeneration++;
+  _stats.increment(ContextStats::NodesCreated, added.size());
+
+  //  Subnodes that land next to each other are inserted as one run, with one
+  //  insertion signal.  The same rule as _createSubnode() decides whether
+  //  views are told about a run; if one isn't exposed, none after it are, so
+  //  the rest go in without signals in a single merge.
+  bool visible = _isVisible(parent);
+  size_t first = 0;
+  while (first < added.size()) {
+    int row = parent->rowForNewSubnode(added[first].first);
+    size_t last = first + 1;
+    while (last < added.size() &&
+           parent->rowForNewSubnode(added[last].first) == row) {
+      last++;
+    }
+
+    int fetched = parent->_fetchedCount;
+    bool exposed =
+        row < fetched ||
+        (row == fetched && fetched == parent->childCount() && fetched > 0);
+    if (!exposed) last = added.size();
+    bool notify = exposed && visible && !_resetting;
+
+    if (notify) {
+      beginInsertRows(_indexForNode(parent), row, row + (last - first) - 1);
+    }
+    parent->addSubnodes(vector<pair<Symbol, Node*>>(added.begin() + first,
+                                                    added.begin() + last));
+    if (exposed) parent->_fetchedCount += last - first;
+    if (notify) endInsertRows();
+    first = last;
+  }
+}
+
+void Context::_emitChangedLeaves() {
+  map<BranchNode*, vector<int>> rows;
+  for (ValueNode* leaf : _changedLeaves) {
+    if (_isVisible(leaf)) rows[leaf->parent()].push_back(leaf->row());
+  }
+  _changedLeaves.clear();
+
+  for (auto& entry : rows) {
+    BranchNode* parent = entry.first;
+    vector<int>& changed = entry.second;
+    sort(changed.begin(), changed.end());
+    for (size_t first = 0; first < changed.size();) {
+      size_t last = first;
+      while (last + 1 < changed.size() &&
+             changed[last + 1] == changed[last] + 1) {
+        last++;
+      }
+      emit dataChanged(
+          _indexForNode(parent->_childAtIndex(changed[first]), 1),
+          _indexForNode(parent->_childAtIndex(changed[last]), 1));
+      first = last + 1;
+    }
+  }
+}
+
+bool Context::isDirty(const string& filePath) const {
+  return _dirtyFiles.count(_symbols.find(filePath)) > 0;
+}
+
+vector<string> Context::dirtyFiles() const {
+  vector<string> paths;
+  for (const string& path : _configFiles) {
+    if (isDirty(path)) paths.push_back(path);
+  }
+  return paths;
+}
+
+void Context::save() {
+  for (const string& path : dirtyFiles()) saveFile(path);
+}
+
+void Context::saveFile(const string& filePath) {
+  if (!isDirty(filePath)) return;
+
+  //  Write next to the file and rename over it, so readers (and a crash
+  //  halfway through) never see a partial file.
+  string tmpPath = filePath + ".tmp";
+  {
+    ofstream out(tmpPath, ios::trunc);
+    Json::StyledStreamWriter writer;
+    writer.write(out, extractJson(filePath));
+    out.close();
+    if (!out) {
+      remove(tmpPath.c_str());
+      throw runtime_error("unable to write file '" + tmpPath + "'");
+    }
+  }
+
+  //  The watcher is told to look away for the rename so the write doesn't
+  //  come back as a reload.  Even if it did, it would be a no-op: the tree
+  //  already holds exactly what was written.
+  QString qpath = QString::fromStdString(filePath);
+  _fsWatcher.removePath(qpath);
+  bool renamed = rename(tmpPath.c_str(), filePath.c_str()) == 0;
+  _fsWatcher.addPath(qpath);
+  if (!renamed) {
+    remove(tmpPath.c_str());
+    throw runtime_error("unable to write file '" + filePath + "'");
+  }
+  _pendingReloads.erase(filePath);
+  _dirtyFiles.erase(_symbols.find(filePath));
+}
+
+#pragma mark Context
+
+size_t Context::bytesUsedByFile(const string& filePath) const {
+  auto itr = _fileTrees.find(filePath);
+  return itr != _fileTrees.end() ? itr->second.bytesUsed() : 0;
 }
 
 int Context::indexOfFile(const string& filePath) const {
-  auto itr = std::find(_configFiles.begin(), _configFiles.end(), filePath);
-  return (itr == _configFiles.end()) ? -1 : itr - _configFiles.begin();
+  return priorityOfFile(_symbols.find(filePath));
+}
+
+int Context::priorityOfFile(Symbol filePath) const {
+  auto itr = _fileIndices.find(filePath);
+  return (itr == _fileIndices.end()) ? -1 : itr->second;
+}
+
+const Node* Context::nodeForKeyPath(const string& keyPath) const {
+  const Node* node = _rootNode;
+  size_t start = 0;
+  while (node && start <= keyPath.length()) {
+    if (node->isLeafNode()) return nullptr;
+
+    size_t end = keyPath.find('.', start);
+    if (end == string::npos) end = keyPath.length();
+    Symbol key = _symbols.find(keyPath.substr(start, end - start));
+    if (key == InvalidSymbol) return nullptr;
+    node = ((const BranchNode*)node)->subnode(key);
+    start = end + 1;
+  }
+  return node;
+}
+
+const Node* Context::nodeForKeyPath(const KeyPath& keyPath) const {
+  const Node* node = _rootNode;
+  for (size_t i = 0; i < keyPath.segmentCount() && node; i++) {
+    if (node->isLeafNode()) return nullptr;
+
+    const KeyPath::Segment& segment = keyPath.segment(i);
+    Symbol key = _symbols.find(segment.hash, keyPath.segmentStr(i),
+                               segment.length);
+    if (key == InvalidSymbol) return nullptr;
+    node = ((const BranchNode*)node)->subnode(key);
+  }
+  return node;
+}
+
+const Value* Context::valueForKeyPath(const KeyPath& keyPath,
+                                      const vector<string>& scope) {
+  LatencyHistogram::Timer timer(_stats.countLookup());
+  if (_image) return _imageValue(keyPath.toString(), scope);
+
+  //  same entries as the string overload, but the key path is never hashed
+  uint64_t hash = ValueCache::Hash(keyPath.hash(), scope);
+  const Value* value;
+  if (_valueCache.find(hash, keyPath.str(), keyPath.length(), scope,
+                       _structureGeneration, &value)) {
+    _stats.increment(ContextStats::CacheHits);
+    return value;
+  }
+  return _resolveIntoCache(nodeForKeyPath(keyPath), hash, keyPath.str(),
+                           keyPath.length(), scope);
+}
+
+const Value* Context::resolveValueForKeyPath(
+    const string& keyPath, const vector<string>& scope) const {
+  if (_image) return _imageValue(keyPath, scope);
+
+  const Node* node = nodeForKeyPath(keyPath);
+  if (!node || !node->isLeafNode()) return nullptr;
+
+  vector<Symbol> scopeSymbols;
+  _symbols.findAll(scope, &scopeSymbols);
+  return ((const ValueNode*)node)->getValue(scopeSymbols);
+}
+
+const Value* Context::valueForKeyPath(const string& keyPath,
+                                      const vector<string>& scope) {
+  LatencyHistogram::Timer timer(_stats.countLookup());
+  if (_image) return _imageValue(keyPath, scope);
+
+  uint64_t hash =
+      ValueCache::Hash(HashString(keyPath.data(), keyPath.size()), scope);
+  const Value* value;
+  if (_valueCache.find(hash, keyPath.data(), keyPath.size(), scope,
+                       _structureGeneration, &value)) {
+    _stats.increment(ContextStats::CacheHits);
+    return value;
+  }
+  return _resolveIntoCache(nodeForKeyPath(keyPath), hash, keyPath.data(),
+                           keyPath.size(), scope);
+}
+
+const Value* Context::_resolveIntoCache(const Node* node, uint64_t hash,
+                                        const char* keyPath, size_t len,
+                                        const vector<string>& scope) {
+  const ValueNode* leaf =
+      (node && node->isLeafNode()) ? (const ValueNode*)node : nullptr;
+  const Value* value = nullptr;
+  if (leaf) {
+    vector<Symbol> scopeSymbols;
+    _symbols.findAll(scope, &scopeSymbols);
+    value = leaf->getValue(scopeSymbols);
+  }
+  _valueCache.insert(hash, keyPath, len, scope, leaf, value,
+                     _structureGeneration);
+  return value;
+}
+
+void Context::loadImage(const string& path) {
+  if (!_configFiles.empty()) {
+    throw invalid_argument(
+        "An image can't be loaded into a context that has files: '" + path +
+        "'");
+  }
+
+  //  note: throws an exception on failure
+  _image = std::make_shared<BinaryImage>(path);
+  _imageValues.clear();
+  _publishSnapshot();
+}
+
+void Context::writeImage(const string& path) const {
+  ImageWriter writer;
+  writer.setFiles(_configFiles);
+  vector<string> keyPath;
+  _addLeavesToImage(_rootNode, &keyPath, &writer);
+  writer.write(path);
+}
+
+void Context::_addLeavesToImage(const BranchNode* node, vector<string>* keyPath,
+                                ImageWriter* writer) const {
+  for (auto& itr : node->_subnodes) {
+    keyPath->push_back(_symbols.str(itr.first));
+    if (itr.second->isLeafNode()) {
+      vector<pair<vector<Symbol>, const ScopedValue*>> winners;
+      ((const ValueNode*)itr.second)->getScopeWinners(&winners);
+      for (auto& winner : winners) {
+        vector<string> scope;
+        for (Symbol name : winner.first) scope.push_back(_symbols.str(name));
+        writer->addValue(*keyPath, scope, winner.second->value());
+      }
+    } else {
+      _addLeavesToImage((const BranchNode*)itr.second, keyPath, writer);
+    }
+    keyPath->pop_back();
+  }
+}
+
+const Value* Context::_imageValue(const string& keyPath,
+                                  const vector<string>& scope) const {
+  ImageValue value = _image->find(keyPath, scope);
+  if (!value.isValid()) return nullptr;
+
+  auto itr = _imageValues.find(value.record());
+  if (itr == _imageValues.end()) {
+    itr = _imageValues.insert(make_pair(value.record(), value.toValue())).first;
+  }
+  return &itr->second;
+}
+
+void Context::_willRemoveNode(Node* node) {
+  vector<Node*>& sameKey = _keyIndex[node->key()];
+  auto indexed = find(sameKey.begin(), sameKey.end(), node);
+  if (indexed != sameKey.end()) {
+    *indexed = sameKey.back();
+    sameKey.pop_back();
+  }
+  if (sameKey.empty()) _keyIndex.erase(node->key());
+
+  if (node->isLeafNode()) {
+    _valueCache.invalidateNode((ValueNode*)node);
+    for (auto& file : _fileLeaves) file.second.erase((ValueNode*)node);
+    _changedLeaves.erase((ValueNode*)node);
+    _unpublishedLeaves.erase((ValueNode*)node);
+    _unpublishedRemovals.insert(node->keyPath());
+  } else {
+    BranchNode* branch = (BranchNode*)node;
+    for (auto itr : branch->_subnodes) {
+      _willRemoveNode(itr.second);
+    }
+  }
+}
+
+void Context::_destroyNode(Node* node) {
+  if (node->isLeafNode()) {
+    _valueNodes.destroy((ValueNode*)node);
+    return;
+  }
+  BranchNode* branch = (BranchNode*)node;
+  for (auto itr : branch->_subnodes) _destroyNode(itr.second);
+  _branchNodes.destroy(branch);
+}
+
+void Context::_publishSnapshot() {
+  std::shared_ptr<const Snapshot> prev = std::atomic_load(&_snapshot);
+
+  std::shared_ptr<Snapshot> next = std::make_shared<Snapshot>();
+  next->_version = prev ? prev->_version + 1 : 1;
+  next->_image = _image;
+
+  //  Only the leaves that changed are rebuilt.  Views and subscriptions are
+  //  told about the key paths whose leaves were rebuilt or removed.
+  vector<string> changed;
+  PathTrie<Snapshot::Entry>::Editor leaves(
+      prev ? prev->_leaves : PathTrie<Snapshot::Entry>());
+  for (const ValueNode* leaf : _unpublishedLeaves) {
+    string keyPath = leaf->keyPath();
+    //  removed and added back since the last snapshot
+    _unpublishedRemovals.erase(keyPath);
+
+    const Snapshot::Entry* old = prev ? prev->_leaves.find(keyPath) : nullptr;
+    if (!leaf->hasValues()) {
+      if (old) {
+        leaves.erase(keyPath);
+        changed.push_back(keyPath);
+      }
+      continue;
+    }
+    if (old && old->generation == leaf->generation()) continue;
+
+    Snapshot::Entry entry;
+    entry.generation = leaf->generation();
+    entry.leaf = _snapshotLeaf(leaf);
+    leaves.set(keyPath, entry);
+    changed.push_back(keyPath);
+  }
+  for (const string& keyPath : _unpublishedRemovals) {
+    if (prev && prev->_leaves.find(keyPath)) {
+      leaves.erase(keyPath);
+      changed.push_back(keyPath);
+    }
+  }
+  _unpublishedLeaves.clear();
+  _unpublishedRemovals.clear();
+  next->_leaves = leaves.finish();
+
+  {
+    //  views are swapped together with the snapshot, so view() never sees
+    //  views that are behind the current snapshot
+    lock_guard<mutex> lock(_viewsMutex);
+    std::atomic_store(&_snapshot, std::shared_ptr<const Snapshot>(next));
+    _snapshotVersion.store(next->_version, std::memory_order_release);
+    if (prev && !_views.empty()) _updateViews(*next, changed);
+  }
+
+  if (prev && !_subscriptions.empty()) {
+    _notifySubscribers(*prev, *next, changed);
+  }
+}
+
+void Context::_updateViews(const Snapshot& next,
+                           const vector<string>& changed) {
+  auto defaultView = _views.find(vector<string>());
+  defaultView->second =
+      ScopeView::update(*defaultView->second, next, changed, nullptr);
+
+  for (auto& entry : _views) {
+    if (entry.first.empty()) continue;
+    entry.second = ScopeView::update(*entry.second, next, changed,
+                                     defaultView->second.get());
+  }
+}
+
+std::shared_ptr<const ScopeView> Context::view(
+    const vector<string>& scope) const {
+  lock_guard<mutex> lock(_viewsMutex);
+  auto itr = _views.find(scope);
+  if (itr != _views.end()) return itr->second;
+
+  std::shared_ptr<const Snapshot> current = snapshot();
+  std::shared_ptr<const ScopeView>& defaultView = _views[vector<string>()];
+  if (!defaultView) {
+    defaultView = ScopeView::build(*current, vector<string>(), nullptr);
+  }
+  if (scope.empty()) return defaultView;
+
+  std::shared_ptr<const ScopeView> built =
+      ScopeView::build(*current, scope, defaultView.get());
+  _views[scope] = built;
+  return built;
+}
+
+void Context::releaseView(const vector<string>& scope) {
+  lock_guard<mutex> lock(_viewsMutex);
+  if (scope.empty() && _views.size() > 1) return;
+  _views.erase(scope);
+}
+
+static bool SameValue(const Value* a, const Value* b) {
+  if (!a || !b) return a == b;
+  return *a == *b;
+}
+
+void Context::_notifySubscribers(const Snapshot& prev, const Snapshot& next,
+                                 const vector<string>& changed) {
+  //  one batch per subscription, in the order they were first matched.  The
+  //  handlers are copied since they may subscribe or unsubscribe.
+  struct Batch {
+    SubscriptionId id;
+    ChangeHandler handler;
+    vector<ValueChange> changes;
+  };
+  vector<Batch> batches;
+  unordered_map<SubscriptionId, size_t> batchIndex;
+  for (const string& keyPath : changed) {
+    _subscriptions.forEachMatch(
+        keyPath, [&](const SubscriptionTrie::Subscription& sub) {
+          const Value* oldValue = prev.value(keyPath, sub.scope);
+          const Value* newValue = next.value(keyPath, sub.scope);
+          if (SameValue(oldValue, newValue)) return;
+
+          auto itr = batchIndex.find(sub.id);
+          if (itr == batchIndex.end()) {
+            itr = batchIndex.insert(make_pair(sub.id, batches.size())).first;
+            batches.push_back(Batch{sub.id, sub.handler, {}});
+          }
+          batches[itr->second].changes.push_back(
+              ValueChange{keyPath, oldValue, newValue});
+        });
+  }
+
+  for (const Batch& batch : batches) {
+    //  unsubscribed by an earlier handler
+    if (!_subscriptions.contains(batch.id)) continue;
+    batch.handler(batch.changes);
+  }
+}
+
+SubscriptionId Context::subscribe(const string& keyPathPrefix,
+                                  ChangeHandler handler,
+                                  const vector<string>& scope) {
+  return _subscriptions.add(keyPathPrefix, scope, std::move(handler));
+}
+
+bool Context::unsubscribe(SubscriptionId id) {
+  return _subscriptions.remove(id);
+}
+
+std::shared_ptr<const Snapshot::Leaf> Context::_snapshotLeaf(
+    const ValueNode* leaf) const {
+  auto built = std::make_shared<Snapshot::Leaf>();
+  vector<pair<vector<Symbol>, const ScopedValue*>> winners;
+  leaf->getScopeWinners(&winners);
+  for (auto& winner : winners) {
+    Snapshot::Leaf* level = built.get();
+    for (Symbol name : winner.first) {
+      auto& sub = level->subscopes[_symbols.str(name)];
+      if (!sub) sub.reset(new Snapshot::Leaf());
+      level = sub.get();
+    }
+    level->hasValue = true;
+    level->value = winner.second->value();
+  }
+  return built;
+}
+
+#pragma mark Queries
+
+void Context::query(const string& pattern,
+                    vector<const Node*>* nodesOut) const {
+  //  parse the pattern, collapsing runs of '**'
+  vector<QuerySegment> segments;
+  size_t start = 0;
+  while (start <= pattern.size()) {
+    size_t end = pattern.find('.', start);
+    if (end == string::npos) end = pattern.size();
+    string key = pattern.substr(start, end - start);
+    start = end + 1;
+
+    QuerySegment segment;
+    segment.key = InvalidSymbol;
+    if (key == "**") {
+      if (!segments.empty() && segments.back().kind == QuerySegment::AnyKeys) {
+        continue;
+      }
+      segment.kind = QuerySegment::AnyKeys;
+    } else if (key == "*") {
+      segment.kind = QuerySegment::AnyKey;
+    } else {
+      segment.kind = QuerySegment::Key;
+      segment.key = _symbols.find(key);
+      //  a key that was never interned can't be in the tree
+      if (segment.key == InvalidSymbol) return;
+    }
+    segments.push_back(segment);
+  }
+
+  //  anchor on the last plain key, the one closest to the leaves
+  int anchor = -1;
+  for (int i = segments.size() - 1; i >= 0; i--) {
+    if (segments[i].kind == QuerySegment::Key) {
+      anchor = i;
+      break;
+    }
+  }
+
+  unordered_set<const Node*> matches;
+  if (anchor == -1) {
+    _queryExpand(_rootNode, segments, 0, &matches);
+  } else {
+    auto candidates = _keyIndex.find(segments[anchor].key);
+    if (candidates == _keyIndex.end()) return;
+    for (const Node* node : candidates->second) {
+      if (_queryPrefixMatches(segments, anchor, node)) {
+        _queryExpand(node, segments, anchor + 1, &matches);
+      }
+    }
+  }
+  nodesOut->insert(nodesOut->end(), matches.begin(), matches.end());
+}
+
+vector<pair<string, const Value*>> Context::queryValues(
+    const string& pattern, const vector<string>& scope) const {
+  vector<const Node*> nodes;
+  query(pattern, &nodes);
+
+  vector<Symbol> scopeSymbols;
+  _symbols.findAll(scope, &scopeSymbols);
+  vector<pair<string, const Value*>> values;
+  for (const Node* node : nodes) {
+    if (!node->isLeafNode()) continue;
+    const Value* value = ((const ValueNode*)node)->getValue(scopeSymbols);
+    if (value) values.push_back(make_pair(node->keyPath(), value));
+  }
+  sort(values.begin(), values.end(),
+       [](const pair<string, const Value*>& a,
+          const pair<string, const Value*>& b) { return a.first < b.first; });
+  return values;
+}
+
+bool Context::_queryKeysMatch(const vector<QuerySegment>& pattern, size_t p,
+                              size_t patternEnd, const vector<Symbol>& keys,
+                              size_t k) {
+  if (p == patternEnd) return k == keys.size();
+
+  const QuerySegment& segment = pattern[p];
+  if (segment.kind == QuerySegment::AnyKeys) {
+    for (size_t skip = k; skip <= keys.size(); skip++) {
+      if (_queryKeysMatch(pattern, p + 1, patternEnd, keys, skip)) return true;
+    }
+    return false;
+  }
+  if (k == keys.size()) return false;
+  if (segment.kind == QuerySegment::Key && segment.key != keys[k]) {
+    return false;
+  }
+  return _queryKeysMatch(pattern, p + 1, patternEnd, keys, k + 1);
+}
+
+bool Context::_queryPrefixMatches(const vector<QuerySegment>& pattern,
+                                  size_t end, const Node* node) const {
+  vector<Symbol> keys;
+  for (const Node* n = node->parent(); n != _rootNode; n = n->parent()) {
+    keys.push_back(n->key());
+  }
+  reverse(keys.begin(), keys.end());
+  return _queryKeysMatch(pattern, 0, end, keys, 0);
+}
+
+void Context::_queryExpand(const Node* node,
+                           const vector<QuerySegment>& pattern, size_t first,
+                           unordered_set<const Node*>* matches) const {
+  if (first == pattern.size()) {
+    if (node != _rootNode) matches->insert(node);
+    return;
+  }
+  if (node->isLeafNode()) {
+    //  only a trailing '**' can match no keys
+    if (first + 1 == pattern.size() &&
+        pattern[first].kind == QuerySegment::AnyKeys) {
+      matches->insert(node);
+    }
+    return;
+  }
+
+  const BranchNode* branch = (const BranchNode*)node;
+  const QuerySegment& segment = pattern[first];
+  switch (segment.kind) {
+    case QuerySegment::Key:
+      if (const Node* child = branch->subnode(segment.key)) {
+        _queryExpand(child, pattern, first + 1, matches);
+      }
+      break;
+    case QuerySegment::AnyKey:
+      for (int row = 0; row < branch->childCount(); row++) {
+        _queryExpand(branch->childAt(row), pattern, first + 1, matches);
+      }
+      break;
+    case QuerySegment::AnyKeys:
+      _queryExpand(node, pattern, first + 1, matches);
+      for (int row = 0; row < branch->childCount(); row++) {
+        _queryExpand(branch->childAt(row), pattern, first, matches);
+      }
+      break;
+  }
 }
 
 #pragma mark Context - Item Model
@@ -423,7 +2036,38 @@ int Context::rowCount(const QModelIndex& parent) const {
     node = static_cast<const Node*>(parent.internalPointer());
   }
 
-  return node->childCount();
+  if (node->isLeafNode()) return 0;
+  return ((const BranchNode*)node)->_fetchedCount;
+}
+
+bool Context::hasChildren(const QModelIndex& parent) const {
+  if (parent.column() > 0) return false;
+  const Node* node = parent.isValid()
+                         ? static_cast<const Node*>(parent.internalPointer())
+                         : _rootNode;
+  return node->childCount() > 0;
+}
+
+bool Context::canFetchMore(const QModelIndex& parent) const {
+  if (parent.column() > 0) return false;
+  const Node* node = parent.isValid()
+                         ? static_cast<const Node*>(parent.internalPointer())
+                         : _rootNode;
+  if (node->isLeafNode()) return false;
+  return ((const BranchNode*)node)->_fetchedCount < node->childCount();
+}
+
+void Context::fetchMore(const QModelIndex& parent) {
+  if (!canFetchMore(parent)) return;
+  BranchNode* node = parent.isValid()
+                         ? static_cast<BranchNode*>(parent.internalPointer())
+                         : _rootNode;
+
+  int count = min(node->childCount() - node->_fetchedCount, FetchBatchSize);
+  beginInsertRows(parent, node->_fetchedCount,
+                  node->_fetchedCount + count - 1);
+  node->_fetchedCount += count;
+  endInsertRows();
 }
 
 int Context::columnCount(const QModelIndex& parent) const { return 2; }
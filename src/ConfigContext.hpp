@@ -1,16 +1,38 @@
 #pragma once
 
 #include <json/json.h>
+#include <atomic>
+#include <deque>
+#include <future>
 #include <vector>
 #include <set>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <fstream>
+#include <iterator>
 #include <iostream>
 #include <stdexcept>
+#include <thread>
+#include <QFileInfo>
 #include <QFileSystemWatcher>
 #include <QAbstractItemModel>
+#include <QTimer>
+#include <unordered_map>
+#include <unordered_set>
+#include "BinaryImage.hpp"
+#include "ConfigContext2.hpp"
+#include "ObjectPool.hpp"
+#include "ScopeIndex.hpp"
+#include "ScopeView.hpp"
+#include "Snapshot.hpp"
+#include "StartupCache.hpp"
+#include "Stats.hpp"
+#include "Subscriptions.hpp"
+#include "SymbolTable.hpp"
+#include "Value.hpp"
+#include "ValueCache.hpp"
 
 namespace CConf {
 
@@ -28,6 +50,30 @@ class TypeMismatchError : public std::runtime_error {
   TypeMismatchError(const std::string& what) : std::runtime_error(what) {}
 };
 
+/// Outcome of Context::addFileAsync() or Context::removeFileAsync()
+struct LoadResult {
+  enum Status {
+    Ok,
+    /// the file couldn't be read or isn't valid json
+    ParseError,
+    /// see TypeMismatchError.  The file's values were unloaded again.
+    TypeMismatch,
+    /// the file was already in the context or, for a removal, wasn't
+    InvalidArgument,
+    /// the context was destroyed before the request was applied
+    Cancelled
+  };
+
+  LoadResult() : status(Ok) {}
+
+  std::string path;
+  Status status;
+  /// what went wrong, empty on success
+  std::string error;
+
+  bool ok() const { return status == Ok; }
+};
+
 class Context;
 class BranchNode;
 
@@ -38,13 +84,19 @@ class Node {
 
   virtual bool isLeafNode() const = 0;
 
-  virtual void removeValuesFromFile(const std::string& filePath) = 0;
+  /// @return whether any values were removed
+  virtual bool removeValuesFromFile(Symbol filePath) = 0;
 
   std::string keyPath() const;
 
   virtual QVariant data(int column) const = 0;
   virtual int childCount() const = 0;
-  virtual int row();
+
+  /// Index of this node among its parent's subnodes, which are sorted by key
+  int row() const { return _row; }
+
+  /// The key of this node in its parent, or InvalidSymbol for the root
+  Symbol key() const { return _key; }
 
   BranchNode* parent() { return _parent; }
   const BranchNode* parent() const { return _parent; }
@@ -63,6 +115,9 @@ class Node {
 
   Context* _context;
   BranchNode* _parent;
+  //  maintained by the parent, so row() and key() don't have to search it
+  Symbol _key;
+  int _row;
 };
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -70,7 +125,7 @@ class Node {
 class BranchNode : public Node {
  public:
   BranchNode(Context* context = nullptr, BranchNode* parent = nullptr)
-      : Node(context, parent) {}
+      : Node(context, parent), _fetchedCount(0) {}
 
   bool isLeafNode() const { return false; }
   int childCount() const;
@@ -81,59 +136,197 @@ class BranchNode : public Node {
     return false;  // FIXME
   }
 
-  int childCount() { return 0; }
-
   // int columnCount() const;
   QVariant data(int column) const;
 
-  Node* operator[](const std::string& key);
+  /// The row a new subnode with @key would be inserted at
+  int rowForNewSubnode(Symbol key) const;
+
+  /// Returns the subnode for @key or nullptr if there isn't one
+  Node* operator[](Symbol key);
+  const Node* subnode(Symbol key) const;
   Node* _childAtIndex(int index);
+  /// The subnode at @row, in key order
+  const Node* childAt(int row) const { return _subnodeOrder[row]; }
   int indexOfSubnode(const Node* child) const;
 
-  void removeValuesFromFile(const std::string& filePath);
+  bool removeValuesFromFile(Symbol filePath);
 
-  void getSubnodeKeys(std::set<std::string>* keysOut);
+  void getSubnodeKeys(std::set<Symbol>* keysOut);
 
-  std::string keyForSubnode(const Node* subnode) const;
+  Symbol keyForSubnode(const Node* subnode) const;
 
  protected:
   friend class Context;
 
-  void addSubnode(Node* node, const std::string& key);
-  void removeSubnode(const std::string& key);
+  void addSubnode(Node* node, Symbol key);
+  /// Adds several subnodes at once.  @sorted must be ordered by key string
+  /// and not empty.
+  void addSubnodes(const std::vector<std::pair<Symbol, Node*>>& sorted);
+  /// Detaches the subnode for @key and returns it.  The caller frees it, see
+  /// Context::_destroyNode().
+  Node* removeSubnode(Symbol key);
+
+  /// Updates the stored row of every subnode from @firstRow on
+  void _renumberSubnodes(int firstRow);
 
  protected:
-  std::vector<std::string> _subnodeOrder;  //  alphabetically ordered keys
-  // TODO: use unique_ptr to subnodes
-  std::map<std::string, Node*> _subnodes;
+  std::vector<Node*> _subnodeOrder;  //  ordered alphabetically by key string
+  /// number of subnodes exposed to views so far, see Context::fetchMore().
+  /// Always a prefix of _subnodeOrder.
+  int _fetchedCount;
+  /// allocated and freed by the Context, see Context::_destroyNode()
+  std::unordered_map<Symbol, Node*> _subnodes;
 };
 
 ////////////////////////////////////////////////////////////////////////////////
 
-class ValueNode : public Node {
+/// A single value for a key path, as defined by one file under one scope.
+/// The value itself lives in the Tree of the file it came from.
+class ScopedValue {
  public:
-  ValueNode(const QVariant& value, const std::string& filePath,
-            const std::vector<std::string>& scope = {})
+  ScopedValue(const Value* value, Symbol filePath,
+              const std::vector<Symbol>& scope = {})
       : _value(value), _filePath(filePath), _scope(scope) {}
 
   bool isDefaultScope() const { return _scope.size() == 0; }
 
+  const std::vector<Symbol>& scope() const { return _scope; }
+  Symbol filePath() const { return _filePath; }
+
+  const Value& value() const { return *_value; }
+
+ private:
+  const Value* _value;
+  Symbol _filePath;
+  std::vector<Symbol> _scope;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+
+/// Leaf of the config tree.  Holds every value that any file in the context
+/// defines for this key path, under any scope.
+class ValueNode : public Node {
+ public:
+  ValueNode(Context* context = nullptr, BranchNode* parent = nullptr)
+      : Node(context, parent), _generation(0) {}
+
   bool isLeafNode() const { return true; }
 
   int childCount() const { return 0; }
-  virtual QVariant data(int column) const override { return _value; }
+  virtual QVariant data(int column) const override;
 
-  void removeValuesFromFile(const std::string& filePath) {}
+  bool removeValuesFromFile(Symbol filePath);
 
-  const std::vector<std::string>& scope() const { return _scope; }
-  const std::string& filePath() const { return _filePath; }
+  /// Adds a value for the given file and scope, replacing the one that file
+  /// previously defined under that scope (if any).  @val must stay valid
+  /// until the file's values are removed again.
+  void addValue(const Value* val, Symbol filePath,
+                const std::vector<Symbol>& scope = {});
+
+  /// Removes the value @filePath defined under @scope
+  /// @return whether there was such a value
+  bool removeValue(Symbol filePath, const std::vector<Symbol>& scope);
+
+  /// Points the value @filePath defined under @scope at @val, which must be
+  /// equal to the old value.  Used when a file is reloaded and its Tree is
+  /// replaced.  Doesn't change the generation, since readers see the same
+  /// value.
+  void rebindValue(const Value* val, Symbol filePath,
+                   const std::vector<Symbol>& scope);
 
-  const QVariant& value() const { return _value; }
+  bool hasValues() const { return !_values.empty(); }
+
+  /// @brief Resolve the value for this key path
+  /// @details The most specific scope that has a value wins.  Ties between
+  /// files are broken by file priority.  See ScopeIndex.
+  ///
+  /// @param scope the scope to resolve under
+  /// @param filePath if valid, only values from this file are considered
+  /// @return the winning value or nullptr if there isn't one
+  const Value* getValue(const std::vector<Symbol>& scope = {},
+                        Symbol filePath = InvalidSymbol) const;
+
+  /// Appends pointers to all values on this node to @valuesOut
+  void getValues(std::vector<const ScopedValue*>* valuesOut) const {
+    _values.getValues(valuesOut);
+  }
+
+  /// Changes every time the set of values on this node changes.  Used to
+  /// validate entries in the Context's resolved-value cache and to share
+  /// unchanged leaves between snapshots.
+  uint64_t generation() const { return _generation; }
+
+  /// Appends the winning value of every scope that has values on this node
+  void getScopeWinners(
+      std::vector<std::pair<std::vector<Symbol>, const ScopedValue*>>*
+          winnersOut) const {
+    std::vector<Symbol> scope;
+    _values.getScopeWinners(&scope, winnersOut);
+  }
 
  private:
-  QVariant _value;
-  std::string _filePath;
-  std::vector<std::string> _scope;
+  void _bumpGeneration();
+
+  ScopeIndex _values;
+  uint64_t _generation;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+
+/// @brief Forward iterator over the nodes below a branch, in pre-order
+///
+/// @details Moves through the tree by parent pointer and row, so it keeps no
+/// stack and never allocates.  Subnodes are visited in key order.  Any change
+/// to the structure of the tree invalidates it.
+class NodeIterator {
+ public:
+  typedef std::forward_iterator_tag iterator_category;
+  typedef const Node* value_type;
+  typedef std::ptrdiff_t difference_type;
+  typedef const Node* const* pointer;
+  typedef const Node* reference;
+
+  /// the end iterator
+  NodeIterator() : _node(nullptr), _root(nullptr), _leavesOnly(false) {}
+  /// the first node below @root, or the first leaf if @leavesOnly is set
+  NodeIterator(const BranchNode* root, bool leavesOnly);
+
+  const Node* operator*() const { return _node; }
+  NodeIterator& operator++();
+  NodeIterator operator++(int) {
+    NodeIterator prev = *this;
+    ++*this;
+    return prev;
+  }
+
+  bool operator==(const NodeIterator& other) const {
+    return _node == other._node;
+  }
+  bool operator!=(const NodeIterator& other) const {
+    return _node != other._node;
+  }
+
+ private:
+  void _advance();
+
+  const Node* _node;
+  const Node* _root;
+  bool _leavesOnly;
+};
+
+/// A subtree to iterate over with a range-based for loop
+class NodeRange {
+ public:
+  NodeRange(const BranchNode* root, bool leavesOnly)
+      : _root(root), _leavesOnly(leavesOnly) {}
+
+  NodeIterator begin() const { return NodeIterator(_root, _leavesOnly); }
+  NodeIterator end() const { return NodeIterator(); }
+
+ private:
+  const BranchNode* _root;
+  bool _leavesOnly;
 };
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -143,17 +336,83 @@ class Context : public QAbstractItemModel {
 
  public:
   Context();
+  ~Context();
 
+  /// Reloads @filePath right away, on the calling thread
   void fileChanged(const QString& filePath);
 
+  /// @brief Reload @filePath in the background
+  ///
+  /// @details Called for every change the file system watcher reports.
+  /// Changes are coalesced until none have come in for the reload delay,
+  /// then the changed files are read and parsed on a worker thread and
+  /// applied here, on the context's thread, in one batch with a single
+  /// snapshot.
+  ///
+  /// Handles editors that save by replacing the file: the new file is
+  /// watched again, and a file that is briefly missing is retried a few
+  /// times before giving up.
+  void scheduleReload(const QString& filePath);
+
+  /// How long scheduleReload() waits for a burst of changes to end
+  void setReloadDelay(int delayMs);
+  static const int DefaultReloadDelayMs = 100;
+
   void addFile(const std::string& path);
 
+  /// @brief Add several files at once, lowest priority first
+  ///
+  /// @details The files are parsed concurrently on a pool of threads, then
+  /// merged one by one in the given order on the calling thread.  The result
+  /// is the same as calling addFile() for each path in order, errors
+  /// included: files before the first failing one stay in the context and
+  /// the error is rethrown.
+  void addFiles(const std::vector<std::string>& paths);
+
+  /// @brief Keep an on-disk cache of parsed files at @cachePath
+  ///
+  /// @details Opt-in; an empty path turns it off.  When addFiles() is called
+  /// on a context without files, the files are read and stamped (path, size,
+  /// mtime and content hash) and checked against the cache.  If every stamp
+  /// matches, in order, the parsed files come from the cache and nothing is
+  /// parsed.  Otherwise the files are parsed as usual and the cache is
+  /// rewritten.  Failing to write the cache is reported but not an error.
+  void setStartupCache(const std::string& cachePath);
+
   Json::Value readFile(const std::string& filePath);
 
+  /// Parses a file straight into a flat Tree with JsonStreamParser, without
+  /// building a Json::Value document.  Throws a std::runtime_error on failure.
+  /// Safe to call from any thread.
+  static Tree readFileTree(const std::string& filePath);
+
   bool containsFile(const std::string& path);
 
   void removeFile(const std::string& filePath);
 
+  /// @brief addFile() without blocking the calling thread
+  ///
+  /// @details The file is read and parsed on a worker thread, then merged on
+  /// the context's thread from its event loop.  Pending addFileAsync() and
+  /// removeFileAsync() calls are applied in the order they were made, so
+  /// file priorities come out the same as with addFile().  Call from the
+  /// context's thread.
+  ///
+  /// Nothing is thrown: errors, type mismatches included, are reported in
+  /// the result, which is also emitted with fileLoadFinished().
+  std::future<LoadResult> addFileAsync(const std::string& path);
+
+  /// removeFile(), applied from the context's event loop in order with
+  /// pending addFileAsync() calls.  See addFileAsync().
+  std::future<LoadResult> removeFileAsync(const std::string& filePath);
+
+ signals:
+  /// Emitted on the context's thread when an addFileAsync() or
+  /// removeFileAsync() call has been applied
+  void fileLoadFinished(const LoadResult& result);
+
+ public:
+
   /// returns -1 if the file isn't a part of this context
   int indexOfFile(const std::string& path) const;
 
@@ -164,6 +423,257 @@ class Context : public QAbstractItemModel {
   int priorityOfFile(const std::string& filePath) const {
     return indexOfFile(filePath);
   }
+  int priorityOfFile(Symbol filePath) const;
+
+  /// Interned keys, scope names and file paths for everything in the context
+  const SymbolTable& symbols() const { return _symbols; }
+
+  /// @brief Look up the resolved value for a key path
+  /// @details Results are cached per (key path, scope) pair, so repeated
+  /// lookups are a single hash table probe as long as the leaf hasn't changed.
+  ///
+  /// @param keyPath dot-separated path, e.g. "motion.max_accel"
+  /// @param scope the scope to resolve under, e.g. {"2008", "robot17"}
+  /// @return the winning value or nullptr if nothing is defined for @keyPath
+  const Value* valueForKeyPath(const std::string& keyPath,
+                               const std::vector<std::string>& scope = {});
+
+  /// Same as valueForKeyPath(), but always walks the tree and skips the cache
+  const Value* resolveValueForKeyPath(
+      const std::string& keyPath,
+      const std::vector<std::string>& scope = {}) const;
+
+  /// Returns the node at @keyPath or nullptr if there isn't one
+  const Node* nodeForKeyPath(const std::string& keyPath) const;
+
+  const BranchNode* rootNode() const { return _rootNode; }
+
+  /// Every node below @root (the whole tree by default), branches included,
+  /// without allocating.  See NodeIterator.
+  NodeRange nodes(const BranchNode* root = nullptr) const {
+    return NodeRange(root ? root : _rootNode, false);
+  }
+
+  /// Every leaf below @root (the whole tree by default)
+  NodeRange leaves(const BranchNode* root = nullptr) const {
+    return NodeRange(root ? root : _rootNode, true);
+  }
+
+  /// @brief Find the nodes whose key paths match a pattern
+  ///
+  /// @details Pattern segments are separated by dots.  '*' matches any one
+  /// key and '**' any number of keys, including none: "motion.*.max_vel",
+  /// "**.kick_speed".  The last plain key in the pattern is looked up in an
+  /// index of nodes by key, and only those candidates are checked, so a
+  /// query doesn't walk the tree unless it has no plain keys at all.
+  ///
+  /// @param nodesOut the matching nodes are appended here, in no particular
+  /// order
+  void query(const std::string& pattern,
+             std::vector<const Node*>* nodesOut) const;
+
+  /// The leaves matching @pattern with their values resolved under @scope,
+  /// sorted by key path.  Leaves without a value for @scope are left out.
+  std::vector<std::pair<std::string, const Value*>> queryValues(
+      const std::string& pattern,
+      const std::vector<std::string>& scope = {}) const;
+
+  /// Overloads for compile-time key paths.  These find each segment by its
+  /// precomputed hash, and share cache entries with the string overloads
+  /// without hashing the key path again.
+  const Node* nodeForKeyPath(const KeyPath& keyPath) const;
+  const Value* valueForKeyPath(const KeyPath& keyPath,
+                               const std::vector<std::string>& scope = {});
+
+  const ValueCache& valueCache() const { return _valueCache; }
+
+  /// @brief Call @handler whenever resolved values at or below a key path
+  /// change
+  ///
+  /// @details Changes are delivered after each batch of changes to the tree
+  /// (adding, removing, reloading or editing files), with one call per
+  /// subscription listing every key path under @keyPathPrefix whose value
+  /// resolved under @scope changed.  Handlers run on the context's thread
+  /// after the new snapshot has been published.
+  ///
+  /// @param keyPathPrefix e.g. "motion" for motion.max_accel, motion.max_vel
+  /// and everything else below motion.  An empty prefix matches everything.
+  /// @return an id for unsubscribe()
+  SubscriptionId subscribe(const std::string& keyPathPrefix,
+                           ChangeHandler handler,
+                           const std::vector<std::string>& scope = {});
+
+  /// @return whether there was such a subscription
+  bool unsubscribe(SubscriptionId id);
+
+  /// @brief Counters and latency histograms for this context
+  /// @details Covers parsing, merging, reloads, file removal, node creation
+  /// and removal, type mismatches and lookups.  Safe to read from any thread.
+  const ContextStats& stats() const { return _stats; }
+  ContextStats& stats() { return _stats; }
+
+  /// Writes stats().toJson() to @out every @intervalMs milliseconds, from
+  /// the context's thread.  An interval of 0 stops the dump.
+  void dumpStatsEvery(int intervalMs, std::ostream* out = &std::cerr);
+
+  /// @brief The most recently published snapshot of the resolved config
+  /// @details Safe to call from any thread.  Readers never wait for a reload:
+  /// the new snapshot is built completely before it replaces the old one, and
+  /// the old one stays alive until its last reader releases it.
+  std::shared_ptr<const Snapshot> snapshot() const {
+    return std::atomic_load(&_snapshot);
+  }
+
+  /// Version of the most recently published snapshot.  Cheaper than
+  /// snapshot()->version() and safe to call from any thread.
+  uint64_t snapshotVersion() const {
+    return _snapshotVersion.load(std::memory_order_acquire);
+  }
+
+  /// @brief The resolved config for one scope, flattened for fast lookups
+  ///
+  /// @details The first call for a scope resolves every key path.  After
+  /// that the context updates the view whenever it publishes a snapshot,
+  /// re-resolving only the key paths that changed, until releaseView().
+  /// The returned view is immutable: call view() again to get the current
+  /// one.  Safe to call from any thread.
+  ///
+  /// Like Snapshot::value(), views find nothing while serving from an image.
+  std::shared_ptr<const ScopeView> view(
+      const std::vector<std::string>& scope = {}) const;
+
+  /// Stops updating the view for @scope.  Views already handed out stay
+  /// valid.  The default-scope view is kept as long as there are others,
+  /// since they share subtrees with it.
+  void releaseView(const std::vector<std::string>& scope);
+
+  /// Memory held by the flat Tree of a file, or 0 if it isn't in the context
+  size_t bytesUsedByFile(const std::string& filePath) const;
+
+  /// @brief Serve lookups from a compiled image instead of config files
+  ///
+  /// @details The image is mapped read-only, not parsed: loading is
+  /// independent of the size of the config, and values are only converted to
+  /// Values when they're looked up.  valueForKeyPath(), snapshot() and
+  /// ConfigValues all read from the image afterwards.  The model and
+  /// nodeForKeyPath() don't see it, and no files can be added.
+  ///
+  /// Throws a std::invalid_argument if the context already has files and a
+  /// std::runtime_error if the image can't be loaded.
+  void loadImage(const std::string& path);
+
+  /// The image loaded with loadImage(), or nullptr
+  const BinaryImage* image() const { return _image.get(); }
+
+  /// Compiles the resolved values of all files in the context into an image
+  /// at @path that loadImage() can serve from.  See BinaryImage.
+  void writeImage(const std::string& path) const;
+
+  /// @brief Extract the json for the given file so it can be written to disk
+  ///
+  /// @details We don't store a Json::Value for trees in the context.  We load
+  /// it from a file, then store it in our custom tree structure.  To write it
+  /// out to disk, we have to convert it from our internal representation back
+  /// to json.  Keys keep the nesting they had in the file, scopes included,
+  /// but comments and key order aren't preserved.
+  ///
+  /// Throws a std::invalid_argument if the file isn't in the context.
+  ///
+  /// @param filePath The path of the file we're extracting for.
+  /// @return the file's current contents, edits included
+  Json::Value extractJson(const std::string& filePath) const;
+
+  /// Converts a value back to json.  The inverse of valueFromJson().
+  static Json::Value jsonFromValue(const Value& value);
+
+  /// @brief Set the value @filePath defines for @keyPath under @scope
+  ///
+  /// @details The value is changed in place if the file already defines it,
+  /// otherwise it's added.  Unless the file already had this value, it's
+  /// marked dirty until it's saved with save() or reloaded from disk (which
+  /// discards the edit).
+  ///
+  /// Throws a TypeMismatchError, leaving everything unchanged, if @keyPath
+  /// runs into a leaf or ends at an object, and a std::invalid_argument if
+  /// the file isn't in the context.
+  void setValue(const std::string& keyPath, const Value& value,
+                const std::string& filePath,
+                const std::vector<std::string>& scope = {});
+
+  /// Removes the value @filePath defines for @keyPath under @scope, marking
+  /// the file dirty.  @return whether there was such a value
+  bool removeValue(const std::string& keyPath, const std::string& filePath,
+                   const std::vector<std::string>& scope = {});
+
+  /// @brief A batch of edits to apply at once
+  ///
+  /// @details Nothing happens until commit(), which applies every edit in one
+  /// pass: each edited file is rebuilt once, each branch that gets new
+  /// subnodes is sorted once, and views get one insertion signal per run of
+  /// adjacent new rows and one dataChanged() per run of changed rows - or a
+  /// single model reset if the batch is larger than TransactionResetThreshold.
+  ///
+  /// If the edits conflict with the tree or each other (a TypeMismatchError),
+  /// commit() throws before anything is changed and the transaction keeps
+  /// its edits.  If applying them fails part way for any other reason, the
+  /// edited files are restored from their old trees before the exception is
+  /// passed on.  A transaction that's never committed changes nothing.
+  ///
+  /// Only files whose contents actually change are marked dirty.
+  class Transaction {
+   public:
+    /// Same as Context::setValue()
+    void set(const std::string& keyPath, const Value& value,
+             const std::string& filePath,
+             const std::vector<std::string>& scope = {});
+
+    /// Same as Context::removeValue().  Removing a value the file doesn't
+    /// define does nothing.
+    void remove(const std::string& keyPath, const std::string& filePath,
+                const std::vector<std::string>& scope = {});
+
+    /// Applies the edits, publishing a single snapshot
+    /// @return the number of edits that set or removed a value
+    size_t commit();
+
+    size_t size() const { return _edits.size(); }
+
+   private:
+    friend class Context;
+
+    struct Edit {
+      bool remove;
+      std::string keyPath;
+      Value value;
+      std::string filePath;
+      std::vector<std::string> scope;
+    };
+
+    explicit Transaction(Context* context) : _context(context) {}
+
+    Context* _context;
+    std::vector<Edit> _edits;
+  };
+
+  Transaction beginTransaction() { return Transaction(this); }
+
+  /// edits plus new nodes past which a commit resets the model instead of
+  /// signalling each change
+  static const size_t TransactionResetThreshold = 256;
+
+  /// Whether @filePath has edits that haven't been saved
+  bool isDirty(const std::string& filePath) const;
+  std::vector<std::string> dirtyFiles() const;
+
+  /// @brief Write every dirty file back to disk
+  /// @details Files without edits aren't touched.  Each file is written to a
+  /// temporary file next to it and renamed over it, so readers never see a
+  /// partial file, and the write doesn't come back as a reload.  Throws a
+  /// std::runtime_error if a file can't be written; it stays dirty.
+  void save();
+
+  /// Same as save(), for a single file
+  void saveFile(const std::string& filePath);
 
   //  Methods for QAbstractModel
   //  see the article on Qt's website for more info on how to subclass
@@ -172,11 +682,22 @@ class Context : public QAbstractItemModel {
   QModelIndex index(int row, int column, const QModelIndex& parent) const;
   QModelIndex parent(const QModelIndex& child) const;
   int rowCount(const QModelIndex& parent = QModelIndex()) const;
+  bool hasChildren(const QModelIndex& parent = QModelIndex()) const;
   int columnCount(const QModelIndex& parent = QModelIndex()) const;
   QVariant data(const QModelIndex& index, int role = Qt::DisplayRole) const;
   Qt::ItemFlags flags(const QModelIndex& index) const;
   QVariant headerData(int section, Qt::Orientation orientation, int role) const;
 
+  /// @brief Lazy population of the model
+  /// @details Branches start out with no rows exposed to views.  Each
+  /// fetchMore() exposes up to FetchBatchSize more of them, so a view only
+  /// pays for the rows it actually shows.  rowCount() reports the exposed
+  /// rows and hasChildren() the real ones.
+  bool canFetchMore(const QModelIndex& parent) const;
+  void fetchMore(const QModelIndex& parent);
+
+  static const int FetchBatchSize = 256;
+
   /// @brief Determine whether the key specifies a (sub)scope rather than a
   /// regular keypath
   /// @details Scopes paths are prefixed with '$$', so we check to see if @key
@@ -189,116 +710,515 @@ class Context : public QAbstractItemModel {
   static std::string extractKeyFromJsonScopeSpecifier(
       const std::string& scopeSpec);
 
- protected:
   /// Anything that isn't a json 'object' type is stored in the tree in a leaf
-  /// node as a QVariant.
-  /// This method creates the corresponding QVariant from a json value.
+  /// node as a Value.
+  /// This method creates the corresponding Value from a json value.
   /// See <json/value.h> for a list of available types
-  static QVariant variantValueFromJson(const Json::Value& json);
+  static Value valueFromJson(const Json::Value& json);
+
+  /// Same as valueFromJson(), converted to the QVariant the model shows
+  static QVariant variantValueFromJson(const Json::Value& json) {
+    return valueFromJson(json).toVariant();
+  }
 
-  /// recursive method to apply the new json value on top of the config
+ protected:
+  /// @brief Recursively merge the values of a parsed file onto the config
   /// (sub)tree
-  /// calls _didInsert, _didDelete, _didChange as it goes
-  /// respects the priorities already present and only replaces if the given
-  /// json
-  /// has higher prioity
-  /// then another leaf node with the same key path.
   ///
-  /// If a type mismatch is encountered, the TypeMismatchError is thrown, but
-  /// the
-  /// values are not
-  /// removed from the tree - that's the job of the caller.
+  /// @details Creates nodes for keys that don't exist yet, emitting the model
+  /// signals as it goes, and records every leaf it adds a value to in the
+  /// file's entry of the reverse index.  Values the file defined before but
+  /// no longer does are removed afterwards by _mergeFile() with the help of
+  /// that index, so this never walks parts of the tree the file doesn't
+  /// touch.
   ///
-  /// As it walks the tree, it removes any values from the @node and its
-  /// subnodes
-  /// that came from
-  /// @filePath, but are not in @json.
+  /// If a type mismatch is encountered, a TypeMismatchError is thrown, but
+  /// the values are not removed from the tree - that's the job of the caller.
   ///
   /// @param node the root of the (sub)tree to merge the new values onto
-  /// @param json the json to merge onto the given tree
-  /// @param filePath the file path of the json - used to lookup the priority of
-  /// @json as necessary
-  void mergeJson(Node* node, const Json::Value& json,
-                 std::vector<std::string>& scope, const std::string& filePath,
-                 std::set<std::string>& unhandledKeys,
-                 bool removeValuesForUnhandledKeys = true);
-
-  /// @brief Extract the json for the given file so it can be written to disk
-  ///
-  /// @details We don't store a Json::Value for trees in the context.  We load
-  /// it
-  /// from a file,
-  /// then store it in our custom tree structure.  To write it out to disk, we
-  /// have have to
-  /// convert it from our internal representation back to json.
-  ///
-  /// @param filePath The path of the file we're extracting for.
-  /// @return
-  Json::Value extractJson(const std::string& filePath) {
-    throw std::invalid_argument("TODO");
-  }
+  /// @param tree the file's values in the flat form built by ReadJson().  The
+  /// merged values point into @tree, so it has to outlive them.
+  /// @param treeNode the node of @tree to merge onto @node
+  /// @param scope the scope the values of @treeNode are defined under
+  /// @param filePath the file the values come from - used to look up its
+  /// priority as necessary
+  void mergeJson(Node* node, const Tree& tree, Tree::Index treeNode,
+                 std::vector<Symbol>& scope, Symbol filePath);
 
  private:
-  //  higher index = higher precedence when cascading values. FIXME: is this
-  //  true?
+  friend class BranchNode;
+  friend class ValueNode;
+
+  /// Result of parsing a file on the reload worker
+  struct ParsedFile {
+    std::string path;
+    Tree tree;
+    /// empty if parsing succeeded
+    std::string error;
+  };
+
+  /// Parses the pending reloads on a worker thread.  Called by _reloadTimer.
+  void _startReloadWorker();
+
+  /// Applies what the reload worker parsed.  Runs on the context's thread.
+  void _applyReloads(std::shared_ptr<std::vector<ParsedFile>> parsed);
+
+  /// A pending addFileAsync() or removeFileAsync() call
+  struct AsyncLoad {
+    AsyncLoad() : remove(false), ready(false) {}
+
+    bool remove;
+    /// the parsed file or parse error, filled in by the worker
+    ParsedFile file;
+    std::thread worker;
+    /// set once @file is filled in
+    std::atomic<bool> ready;
+    std::promise<LoadResult> promise;
+  };
+
+  /// Applies the finished calls at the front of _asyncLoads, stopping at the
+  /// first one that's still parsing.  Runs on the context's thread.
+  void _applyAsyncLoads();
+
+  /// Merges or removes the file of @load and reports how it went
+  LoadResult _applyAsyncLoad(AsyncLoad& load);
+
+  /// Forgets the unsaved edits of @path because it's being reloaded from disk
+  void _discardEdits(const std::string& path);
+
+  /// Applies a transaction's edits.  See Transaction.
+  size_t _commit(const std::vector<Transaction::Edit>& edits);
+
+  /// @brief Undo a commit that failed part way
+  /// @details Unloads @paths, prunes the nodes in @created that are left
+  /// empty, and merges each file's old tree again.  The first @applied files
+  /// were swapped already, so their old trees are in @oldTrees; the others
+  /// still have theirs in _fileTrees.
+  void _restoreFiles(const std::vector<std::string>& paths,
+                     const std::vector<Tree*>& oldTrees, size_t applied,
+                     const std::set<std::vector<Symbol>>& created);
+
+  /// Creates the nodes for each of @keyPaths that don't exist yet, adding
+  /// all new subnodes of a branch at once
+  void _createNodes(const std::set<std::vector<Symbol>>& keyPaths);
+
+  /// Adds subnodes for @keys (key -> is leaf) to @parent in as few runs as
+  /// possible, emitting one insertion signal per run
+  void _createSubnodes(BranchNode* parent, const std::map<Symbol, bool>& keys);
+
+  /// Emits dataChanged() for _changedLeaves, one per run of adjacent rows
+  void _emitChangedLeaves();
+
+  /// Ends the model reset or the coalescing a commit started
+  void _endCommitSignals(bool reset);
+
+  /// Throws a TypeMismatchError if a leaf can't be created at @keyPath
+  void _checkCanSetLeaf(const std::vector<std::string>& keyPath) const;
+
+  /// times a missing file is retried before its reload is dropped
+  static const int MaxReloadRetries = 20;
+
+  /// (key path, scope) of a leaf value in a file
+  typedef std::pair<std::vector<Symbol>, std::vector<Symbol>> LeafKey;
+
+  /// readFileTree() plus stats.  Parses @contents instead of reading the
+  /// file if given.  Safe to call from any thread.
+  Tree _parseFile(const std::string& path,
+                  const std::string* contents = nullptr);
+
+  /// Throws if @path can't be added with addFile()
+  void _checkCanAddFile(const std::string& path) const;
+
+  /// @brief Register a parsed file and merge its values onto the tree
+  /// @details Takes ownership of @parsed.  Doesn't publish a snapshot.  On a
+  /// TypeMismatchError the file is unloaded again before rethrowing.
+  void _mergeFile(const std::string& path, Tree& parsed);
+
+  /// Collects every leaf value of @tree, keyed by key path and scope
+  void _collectLeaves(const Tree& tree, Tree::Index index,
+                      std::vector<Symbol>* keyPath, std::vector<Symbol>* scope,
+                      std::map<LeafKey, Tree::Index>* leavesOut);
+
+  /// @brief Apply a reparsed file to the tree by diffing it against the
+  /// file's previous contents
+  ///
+  /// @details Values that didn't change are only re-pointed at @newTree, values
+  /// that did change are replaced, and values that were added or removed cause
+  /// nodes to be inserted or pruned.  Model signals are only emitted for the
+  /// nodes that actually changed.  On success @newTree is swapped into
+  /// _fileTrees.  If the new contents don't fit the tree's structure the file
+  /// is removed from the context altogether.
+  void _reloadFile(Symbol filePath, const std::string& path, Tree& newTree);
+
+  /// The diff of _reloadFile(), which throws a TypeMismatchError instead of
+  /// removing the file.  The file's values are then partly applied, and some
+  /// of them point into @newTree.
+  void _applyFileTree(Symbol filePath, const std::string& path,
+                      Tree& newTree);
+
+  /// Returns the node at the given key path or nullptr
+  Node* _nodeForKeySymbols(const std::vector<Symbol>& keyPath);
+
+  /// Returns the leaf at the given key path, creating it and any missing
+  /// branches on the way.  Throws a TypeMismatchError if the path runs into a
+  /// leaf or ends at a branch.
+  ValueNode* _leafForKeySymbols(const std::vector<Symbol>& keyPath);
+
+  /// Creates a subnode of @parent, emitting the model insertion signals
+  Node* _createSubnode(BranchNode* parent, Symbol key, bool isLeaf);
+
+  /// Removes @node if it holds no values (or, for branches, has no subnodes)
+  /// and repeats for its parent.  Emits the model removal signals.
+  void _pruneIfEmpty(Node* node);
+
+  /// Deletes @child, emitting the model removal signals
+  void _removeSubnode(BranchNode* parent, Node* child);
+
+  /// Returns @node and everything below it to the node pools
+  void _destroyNode(Node* node);
+
+  QModelIndex _indexForNode(Node* node, int column = 0) const;
+
+  /// Whether views know about @node, i.e. it and all of its ancestors are
+  /// within their parents' fetched rows
+  bool _isVisible(const Node* node) const;
+
+  /// Adds a value to @leaf and records it in the reverse index
+  void _addFileValue(ValueNode* leaf, const Value* value, Symbol filePath,
+                     const std::vector<Symbol>& scope);
+
+  /// Removes every value @filePath contributed, pruning the nodes that are
+  /// left empty.  Only visits the leaves in the file's reverse index.
+  void _removeValuesFromFile(Symbol filePath);
+
+  /// Unloads @filePath's values and forgets the file: its Tree, its priority
+  /// and its dirty state.  Doesn't publish a snapshot.
+  void _unregisterFile(const std::string& filePath);
+
+  /// Removes the values of @filePath from each of @leaves and prunes or
+  /// signals as needed
+  void _removeValuesFromLeaves(Symbol filePath,
+                               const std::unordered_set<ValueNode*>& leaves);
+
+  /// Tells views that the resolved value of @leaf may have changed
+  void _leafValuesChanged(ValueNode* leaf);
+
+  /// Publishes a new snapshot, made from the previous one by applying the
+  /// leaves changed or removed since then, as the one returned by
+  /// snapshot().  Must be called after every batch of changes to the tree.
+  void _publishSnapshot();
+
+  /// Builds the snapshot leaf for the current values of @leaf
+  std::shared_ptr<const Snapshot::Leaf> _snapshotLeaf(
+      const ValueNode* leaf) const;
+
+  /// Calls the subscriptions matching the key paths that changed between
+  /// two snapshots
+  void _notifySubscribers(const Snapshot& prev, const Snapshot& next,
+                          const std::vector<std::string>& changed);
+
+  /// Brings every view in _views up to @next.  @changed are the key paths
+  /// that changed since the previous snapshot.  Requires _viewsMutex.
+  void _updateViews(const Snapshot& next,
+                    const std::vector<std::string>& changed);
+
+  /// Adds the scope winners of every leaf below @node to @writer
+  void _addLeavesToImage(const BranchNode* node,
+                         std::vector<std::string>* keyPath,
+                         ImageWriter* writer) const;
+
+  /// Resolves the value at @node (the node at @keyPath, or nullptr) and
+  /// caches it under @hash, a ValueCache::Hash()
+  const Value* _resolveIntoCache(const Node* node, uint64_t hash,
+                                 const char* keyPath, size_t len,
+                                 const std::vector<std::string>& scope);
+
+  /// Looks up a value in _image, converting it to a Value the first time
+  const Value* _imageValue(const std::string& keyPath,
+                           const std::vector<std::string>& scope) const;
+
+  /// Called by BranchNode before it deletes a subnode so cache entries
+  /// pointing into that subtree can be dropped.
+  void _willRemoveNode(Node* node);
+
+  /// One segment of a query() pattern
+  struct QuerySegment {
+    enum Kind { Key, AnyKey, AnyKeys } kind;
+    /// for Key segments
+    Symbol key;
+  };
+
+  /// Whether the keys of @node's ancestors, from the root down, match
+  /// @pattern[0, @end)
+  bool _queryPrefixMatches(const std::vector<QuerySegment>& pattern,
+                           size_t end, const Node* node) const;
+
+  /// Whether @keys[k...] match @pattern[p, patternEnd), glob style
+  static bool _queryKeysMatch(const std::vector<QuerySegment>& pattern,
+                              size_t p, size_t patternEnd,
+                              const std::vector<Symbol>& keys, size_t k);
+
+  /// Adds the nodes at or below @node that match @pattern from segment
+  /// @first on
+  void _queryExpand(const Node* node, const std::vector<QuerySegment>& pattern,
+                    size_t first,
+                    std::unordered_set<const Node*>* matches) const;
+
+  SymbolTable _symbols;
+
+  //  higher index = higher precedence when cascading values
   std::vector<std::string> _configFiles;
+  /// index of each file in _configFiles, so priority lookups don't have to
+  /// search the list
+  std::unordered_map<Symbol, int> _fileIndices;
+  /// flat storage for the values of each file
+  std::map<std::string, Tree> _fileTrees;
+  /// every node in the tree by key, for query()
+  std::unordered_map<Symbol, std::vector<Node*>> _keyIndex;
+  /// files with edits that haven't been saved
+  std::unordered_set<Symbol> _dirtyFiles;
+  /// reverse index: the leaves each file has contributed values to.  May
+  /// include leaves the file no longer has values on, but never deleted ones.
+  std::unordered_map<Symbol, std::unordered_set<ValueNode*>> _fileLeaves;
+  /// Storage for the merged tree.  Nodes are shared by every file that
+  /// defines values below them, so they're pooled per context rather than per
+  /// file.
+  ObjectPool<BranchNode> _branchNodes;
+  ObjectPool<ValueNode> _valueNodes;
   BranchNode* _rootNode;
+
+  /// set while a model reset is in progress: no other model signals
+  bool _resetting;
+  /// set while a transaction is applied: value changes are collected in
+  /// _changedLeaves and signalled afterwards
+  bool _coalescing;
+  std::unordered_set<ValueNode*> _changedLeaves;
+  /// leaves whose values changed since the last snapshot was published, and
+  /// the key paths of the leaves removed since then
+  std::unordered_set<const ValueNode*> _unpublishedLeaves;
+  std::unordered_set<std::string> _unpublishedRemovals;
+
   QFileSystemWatcher _fsWatcher;
+
+  /// files waiting to be reloaded, with the number of times each was found
+  /// missing
+  std::map<std::string, int> _pendingReloads;
+  QTimer _reloadTimer;
+  std::thread _reloadWorker;
+  /// set while the worker's results haven't been applied yet
+  bool _reloadInProgress;
+
+  /// addFileAsync() and removeFileAsync() calls not applied yet, in order
+  std::deque<std::shared_ptr<AsyncLoad>> _asyncLoads;
+
+  ValueCache _valueCache;
+
+  SubscriptionTrie _subscriptions;
+
+  ContextStats _stats;
+  QTimer _statsTimer;
+  std::ostream* _statsOut;
+
+  /// only ever accessed through std::atomic_load/atomic_store
+  std::shared_ptr<const Snapshot> _snapshot;
+  std::atomic<uint64_t> _snapshotVersion;
+  /// views handed out by view(), by scope.  Whenever there are any, the
+  /// default-scope view is one of them.
+  mutable std::mutex _viewsMutex;
+  mutable std::map<std::vector<std::string>, std::shared_ptr<const ScopeView>>
+      _views;
+  /// see setStartupCache()
+  std::string _startupCachePath;
+
+  /// incremented whenever a node is added to the tree
+  uint64_t _structureGeneration;
+
+  /// set by loadImage() and shared with every snapshot published after it
+  std::shared_ptr<const BinaryImage> _image;
+  /// values of _image that have been looked up, by image record
+  mutable std::unordered_map<const Image::Value*, Value> _imageValues;
 };
 
+/// @brief Handle to a single value in a Context
+///
+/// @details The key path is resolved once and the converted value is kept
+/// along with the version of the Context snapshot it came from.  Reading the
+/// value only compares that version against the context's current one (a
+/// single atomic load) and re-resolves when they differ, so reads in a hot
+/// loop don't hash strings or allocate.
+///
+/// Resolution goes through Context::snapshot(), so a ConfigValue may be used
+/// on any thread - but a single ConfigValue must not be read from several
+/// threads at once.
 template <typename T>
 class ConfigValue {
  public:
-  // ConfigValue(const std::string& keyPath, T defaultValue, const std::string&
-  // comment = "");
+  ConfigValue(const std::string& keyPath, T defaultValue,
+              const std::string& comment = "")
+      : ConfigValue(nullptr, keyPath, defaultValue, comment) {}
+  ConfigValue(std::shared_ptr<Context> ctxt, const KeyPath& keyPath,
+              T defaultValue, const std::string& comment = "")
+      : ConfigValue(ctxt, keyPath.toString(), defaultValue, comment) {
+    _hashedKeyPath = keyPath;
+  }
   ConfigValue(std::shared_ptr<Context> ctxt, const std::string& keyPath,
-              T defaultValue, const std::string& comment = "");
+              T defaultValue, const std::string& comment = "")
+      : _keyPath(keyPath),
+        _value(defaultValue),
+        _defaultValue(defaultValue),
+        _comment(comment),
+        _context(ctxt),
+        _version(0) {}
+
+  void setContext(std::shared_ptr<Context> ctxt) {
+    _context = ctxt;
+    _version = 0;
+  }
 
-  void setContext(Context* ctxt) { _context = ctxt; }
+  const Context* context() const { return _context.get(); }
 
-  const Context* context() const { return _context; }
+  const std::string& keyPath() const { return _keyPath; }
 
   const std::string& comment() const { return _comment; }
 
-  // TODO: operator dereferene
+  const T& defaultValue() const { return _defaultValue; }
 
-  // TODO: signal for value change?
+  const std::vector<std::string>& scope() const { return _scope; }
+  void setScope(const std::vector<std::string>& scope) {
+    _scope = scope;
+    _version = 0;
+  }
 
-  // TODO: add scope
+  /// The resolved value, or the default value if the context doesn't define
+  /// one for this key path and scope
+  const T& value() {
+    if (_context && _context->snapshotVersion() != _version) _resolve();
+    return _value;
+  }
+
+  const T& operator*() { return value(); }
+
+  //  for change notifications, see Context::subscribe()
 
  private:
+  void _resolve() {
+    std::shared_ptr<const Snapshot> snapshot = _context->snapshot();
+    if (const BinaryImage* image = snapshot->image()) {
+      ImageValue value = image->find(_keyPath, _scope);
+      _value = value.isValid() ? ValueAs<T>(value.toValue()) : _defaultValue;
+    } else {
+      const Value* value = _hashedKeyPath.empty()
+                               ? snapshot->value(_keyPath, _scope)
+                               : snapshot->value(_hashedKeyPath, _scope);
+      _value = value ? ValueAs<T>(*value) : _defaultValue;
+    }
+    _version = snapshot->version();
+  }
+
   std::string _keyPath;
+  /// set if this was made from a KeyPath, so lookups use its hashes
+  KeyPath _hashedKeyPath;
   T _value;
+  T _defaultValue;
   std::vector<std::string> _scope;
   std::string _comment;
   std::shared_ptr<Context> _context;
+  /// version of the snapshot _value was resolved from.  0 is never published,
+  /// so it means "not resolved yet".
+  uint64_t _version;
 };
 
 class ConfigDouble : public ConfigValue<double> {
  public:
   ConfigDouble(const std::string& keyPath, double defaultValue = 0,
-               const std::string& comment = "");
-  operator double();
+               const std::string& comment = "")
+      : ConfigValue<double>(keyPath, defaultValue, comment) {}
+  ConfigDouble(std::shared_ptr<Context> ctxt, const std::string& keyPath,
+               double defaultValue = 0, const std::string& comment = "")
+      : ConfigValue<double>(ctxt, keyPath, defaultValue, comment) {}
+  ConfigDouble(std::shared_ptr<Context> ctxt, const KeyPath& keyPath,
+               double defaultValue = 0, const std::string& comment = "")
+      : ConfigValue<double>(ctxt, keyPath, defaultValue, comment) {}
+  operator double() { return value(); }
 };
 
 class ConfigString : public ConfigValue<std::string> {
  public:
   ConfigString(const std::string& keyPath, const std::string& defaultValue = "",
-               const std::string& comment = "");
-  operator std::string();
+               const std::string& comment = "")
+      : ConfigValue<std::string>(keyPath, defaultValue, comment) {}
+  ConfigString(std::shared_ptr<Context> ctxt, const std::string& keyPath,
+               const std::string& defaultValue = "",
+               const std::string& comment = "")
+      : ConfigValue<std::string>(ctxt, keyPath, defaultValue, comment) {}
+  ConfigString(std::shared_ptr<Context> ctxt, const KeyPath& keyPath,
+               const std::string& defaultValue = "",
+               const std::string& comment = "")
+      : ConfigValue<std::string>(ctxt, keyPath, defaultValue, comment) {}
+  operator std::string() { return value(); }
 };
 
-// template<typename T>
-// class ConfigVector : public ConfigValue<std::vector<T> > {
-// public:
-//     ConfigVector(const std::string& keyPath, const std::vector<T>&
-//     defaultValue = {}, const std::string& comment = "");
-// };
-
-// class ConfigVectorDouble : public ConfigVector<double> {
-// public:
-//     ConfigVector(const std::string& keyPath, const std::vector<double>&
-//     defaultValue = {}, const std::string& comment = "");
-// };
+/// @brief Handle to a list of numbers in a Context
+///
+/// @details Number lists are stored packed (see Value), so span() views the
+/// resolved list in place: no copy is made when it's resolved, and reading it
+/// in a loop touches one contiguous, aligned buffer.  A span stays valid
+/// until the handle re-resolves, i.e. until the next read after the context
+/// changes.
+///
+/// T is double or int.  If the resolved value isn't a list of T (for int,
+/// any non-integer element disqualifies it), the default is used.
+template <typename T>
+class ConfigVector : public ConfigValue<Value> {
+ public:
+  ConfigVector(const std::string& keyPath,
+               const std::vector<T>& defaultValue = {},
+               const std::string& comment = "")
+      : ConfigValue<Value>(keyPath, _listValue(defaultValue), comment) {}
+  ConfigVector(std::shared_ptr<Context> ctxt, const std::string& keyPath,
+               const std::vector<T>& defaultValue = {},
+               const std::string& comment = "")
+      : ConfigValue<Value>(ctxt, keyPath, _listValue(defaultValue), comment) {}
+  ConfigVector(std::shared_ptr<Context> ctxt, const KeyPath& keyPath,
+               const std::vector<T>& defaultValue = {},
+               const std::string& comment = "")
+      : ConfigValue<Value>(ctxt, keyPath, _listValue(defaultValue), comment) {}
+
+  Span<T> span() {
+    Span<T> elements = ValueSpan<T>(value());
+    return elements.empty() ? ValueSpan<T>(defaultValue()) : elements;
+  }
+
+  size_t size() { return span().size(); }
+  T operator[](size_t i) { return span()[i]; }
+
+  std::vector<T> toVector() {
+    Span<T> elements = span();
+    return std::vector<T>(elements.begin(), elements.end());
+  }
+
+ private:
+  static Value _listValue(const std::vector<T>& elements) {
+    std::vector<Value> lst;
+    for (T element : elements) lst.push_back(Value(element));
+    return Value(std::move(lst));
+  }
+};
+
+class ConfigVectorDouble : public ConfigVector<double> {
+ public:
+  ConfigVectorDouble(const std::string& keyPath,
+                     const std::vector<double>& defaultValue = {},
+                     const std::string& comment = "")
+      : ConfigVector<double>(keyPath, defaultValue, comment) {}
+  ConfigVectorDouble(std::shared_ptr<Context> ctxt, const std::string& keyPath,
+                     const std::vector<double>& defaultValue = {},
+                     const std::string& comment = "")
+      : ConfigVector<double>(ctxt, keyPath, defaultValue, comment) {}
+  ConfigVectorDouble(std::shared_ptr<Context> ctxt, const KeyPath& keyPath,
+                     const std::vector<double>& defaultValue = {},
+                     const std::string& comment = "")
+      : ConfigVector<double>(ctxt, keyPath, defaultValue, comment) {}
+};
 
 };  //  end namespace CConf
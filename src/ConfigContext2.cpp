@@ -0,0 +1,411 @@
+#include "ConfigContext2.hpp"
+#include "ConfigContext.hpp"
+#include <utility>
+
+using namespace std;
+
+namespace CConf {
+
+const Tree::Index Tree::InvalidIndex;
+
+size_t Tree::bytesUsed() const {
+  size_t bytes = sizeof(Tree) + _nodes.capacity() * sizeof(Node) +
+                 _keys.capacity() * sizeof(string) +
+                 _values.capacity() * sizeof(Value);
+  for (const string& key : _keys) bytes += key.capacity();
+  for (const Value& value : _values) bytes += value.bytesUsed();
+  return bytes;
+}
+
+template <typename T>
+static void WritePod(ostream& out, T value) {
+  out.write((const char*)&value, sizeof(T));
+}
+
+template <typename T>
+static bool ReadPod(istream& in, T* valueOut) {
+  return (bool)in.read((char*)valueOut, sizeof(T));
+}
+
+static void WriteValue(ostream& out, const Value& value) {
+  WritePod<uint8_t>(out, value.type());
+  switch (value.type()) {
+    case Value::Null:
+      break;
+    case Value::Bool:
+      WritePod<uint8_t>(out, value.toBool());
+      break;
+    case Value::Int:
+    case Value::UInt:
+      WritePod<int64_t>(out, value.toInt());
+      break;
+    case Value::Double:
+      WritePod<double>(out, value.toDouble());
+      break;
+    case Value::String:
+      WritePod<uint32_t>(out, value.stringLength());
+      out.write(value.stringData(), value.stringLength());
+      break;
+    case Value::List:
+      WritePod<uint32_t>(out, value.listSize());
+      for (size_t i = 0; i < value.listSize(); i++) {
+        WriteValue(out, value.listAt(i));
+      }
+      break;
+  }
+}
+
+static bool ReadValue(istream& in, Value* valueOut) {
+  uint8_t type;
+  if (!ReadPod(in, &type)) return false;
+  switch (type) {
+    case Value::Null:
+      *valueOut = Value();
+      return true;
+    case Value::Bool: {
+      uint8_t b;
+      if (!ReadPod(in, &b)) return false;
+      *valueOut = Value(b != 0);
+      return true;
+    }
+    case Value::Int:
+    case Value::UInt: {
+      int64_t i;
+      if (!ReadPod(in, &i)) return false;
+      *valueOut = type == Value::Int ? Value(i) : Value((uint64_t)i);
+      return true;
+    }
+    case Value::Double: {
+      double d;
+      if (!ReadPod(in, &d)) return false;
+      *valueOut = Value(d);
+      return true;
+    }
+    case Value::String: {
+      uint32_t length;
+      if (!ReadPod(in, &length)) return false;
+      string str(length, '\0');
+      if (!in.read(&str[0], length)) return false;
+      *valueOut = Value(str);
+      return true;
+    }
+    case Value::List: {
+      uint32_t size;
+      if (!ReadPod(in, &size)) return false;
+      vector<Value> list;
+      for (uint32_t i = 0; i < size; i++) {
+        list.emplace_back();
+        if (!ReadValue(in, &list.back())) return false;
+      }
+      *valueOut = Value(std::move(list));
+      return true;
+    }
+    default:
+      return false;
+  }
+}
+
+void Tree::write(ostream& out) const {
+  WritePod<uint32_t>(out, _nodes.size());
+  for (const Node& n : _nodes) {
+    WritePod(out, n.parent);
+    WritePod(out, n.firstChild);
+    WritePod(out, n.nextSibling);
+    WritePod(out, n.childCount);
+    WritePod(out, n.key);
+    WritePod(out, n.value);
+    WritePod<uint8_t>(out, n.isScope);
+  }
+  WritePod<uint32_t>(out, _keys.size());
+  for (const string& key : _keys) {
+    WritePod<uint32_t>(out, key.size());
+    out.write(key.data(), key.size());
+  }
+  WritePod<uint32_t>(out, _values.size());
+  for (const Value& value : _values) WriteValue(out, value);
+}
+
+bool Tree::read(istream& in, Tree* treeOut) {
+  Tree tree;
+  uint32_t nodeCount;
+  if (!ReadPod(in, &nodeCount)) return false;
+  tree._nodes.resize(nodeCount);
+  for (Node& n : tree._nodes) {
+    uint8_t isScope;
+    if (!ReadPod(in, &n.parent) || !ReadPod(in, &n.firstChild) ||
+        !ReadPod(in, &n.nextSibling) || !ReadPod(in, &n.childCount) ||
+        !ReadPod(in, &n.key) || !ReadPod(in, &n.value) ||
+        !ReadPod(in, &isScope)) {
+      return false;
+    }
+    n.isScope = isScope != 0;
+  }
+
+  uint32_t keyCount;
+  if (!ReadPod(in, &keyCount)) return false;
+  for (uint32_t i = 0; i < keyCount; i++) {
+    uint32_t length;
+    if (!ReadPod(in, &length)) return false;
+    string key(length, '\0');
+    if (length && !in.read(&key[0], length)) return false;
+    tree._keys.push_back(std::move(key));
+  }
+
+  uint32_t valueCount;
+  if (!ReadPod(in, &valueCount)) return false;
+  tree._values.resize(valueCount);
+  for (Value& value : tree._values) {
+    if (!ReadValue(in, &value)) return false;
+  }
+
+  //  every index has to point inside the tree, so a damaged file can't make
+  //  the accessors read out of bounds
+  auto validNode = [nodeCount](Index i) {
+    return i == InvalidIndex || i < nodeCount;
+  };
+  for (const Node& n : tree._nodes) {
+    if (!validNode(n.parent) || !validNode(n.firstChild) ||
+        !validNode(n.nextSibling) ||
+        n.key >= keyCount ||
+        (n.value != InvalidIndex && n.value >= valueCount)) {
+      return false;
+    }
+  }
+
+  *treeOut = std::move(tree);
+  return true;
+}
+
+Tree::Index Tree::_addNode(Index parent, uint32_t key, bool isScope) {
+  Node n;
+  n.parent = parent;
+  n.firstChild = InvalidIndex;
+  n.nextSibling = InvalidIndex;
+  n.childCount = 0;
+  n.key = key;
+  n.value = InvalidIndex;
+  n.isScope = isScope;
+  _nodes.push_back(n);
+  return _nodes.size() - 1;
+}
+
+Tree::Index Tree::_appendChild(Index parent, const string& key,
+                               bool isScope) {
+  Index index = _addNode(parent, _addKey(key), isScope);
+  Node& parentNode = _nodes[parent];
+  if (parentNode.firstChild == InvalidIndex) {
+    parentNode.firstChild = index;
+  } else {
+    Index last = parentNode.firstChild;
+    while (_nodes[last].nextSibling != InvalidIndex) {
+      last = _nodes[last].nextSibling;
+    }
+    _nodes[last].nextSibling = index;
+  }
+  parentNode.childCount++;
+  return index;
+}
+
+Tree::Index Tree::_child(Index parent, const string& key, bool isScope) const {
+  for (Index child = firstChild(parent); child != InvalidIndex;
+       child = nextSibling(child)) {
+    if (_nodes[child].isScope == isScope && _keyIs(child, key)) return child;
+  }
+  return InvalidIndex;
+}
+
+#pragma mark Editing
+
+Tree::Index Tree::findLeaf(const vector<string>& keyPath,
+                           const vector<string>& scope) const {
+  if (empty()) return InvalidIndex;
+  return _findLeaf(root(), keyPath, 0, scope, 0);
+}
+
+Tree::Index Tree::_findLeaf(Index index, const vector<string>& keyPath,
+                            size_t key, const vector<string>& scope,
+                            size_t level) const {
+  for (Index child = firstChild(index); child != InvalidIndex;
+       child = nextSibling(child)) {
+    size_t childKey = key, childLevel = level;
+    if (_nodes[child].isScope) {
+      if (level == scope.size() || !_keyIs(child, scope[level])) continue;
+      childLevel++;
+    } else {
+      if (key == keyPath.size() || !_keyIs(child, keyPath[key])) continue;
+      childKey++;
+    }
+
+    if (isLeaf(child)) {
+      if (childKey == keyPath.size() && childLevel == scope.size()) {
+        return child;
+      }
+      continue;
+    }
+    Index found = _findLeaf(child, keyPath, childKey, scope, childLevel);
+    if (found != InvalidIndex) return found;
+  }
+  return InvalidIndex;
+}
+
+void Tree::setValue(Index leaf, const Value& value) {
+  _values[_nodes[leaf].value] = value;
+}
+
+Tree::Index Tree::addLeaf(const vector<string>& keyPath,
+                          const vector<string>& scope, const Value& value) {
+  //  scopes first, then keys
+  size_t length = scope.size() + keyPath.size();
+  auto segment = [&](size_t i) -> const string& {
+    return i < scope.size() ? scope[i] : keyPath[i - scope.size()];
+  };
+
+  //  check the whole path before adding anything to it
+  Index node = empty() ? InvalidIndex : root();
+  size_t existing = 0;
+  while (node != InvalidIndex && existing < length) {
+    Index child = _child(node, segment(existing), existing < scope.size());
+    if (child == InvalidIndex) break;
+    if (isLeaf(child) != (existing + 1 == length)) return InvalidIndex;
+    node = child;
+    existing++;
+  }
+  if (existing == length && node != InvalidIndex) {
+    setValue(node, value);
+    return node;
+  }
+
+  if (node == InvalidIndex) node = _addNode(InvalidIndex, _addKey(""), false);
+  for (size_t i = existing; i < length; i++) {
+    node = _appendChild(node, segment(i), i < scope.size());
+  }
+  _nodes[node].value = _values.size();
+  _values.push_back(value);
+  return node;
+}
+
+void Tree::removeLeaf(Index leaf) {
+  Node& parent = _nodes[_nodes[leaf].parent];
+  if (parent.firstChild == leaf) {
+    parent.firstChild = _nodes[leaf].nextSibling;
+  } else {
+    Index prev = parent.firstChild;
+    while (_nodes[prev].nextSibling != leaf) prev = _nodes[prev].nextSibling;
+    _nodes[prev].nextSibling = _nodes[leaf].nextSibling;
+  }
+  parent.childCount--;
+  _nodes[leaf].parent = InvalidIndex;
+  _nodes[leaf].nextSibling = InvalidIndex;
+}
+
+Tree Tree::compacted() const {
+  TreeBuilder builder;
+  if (!empty()) _emit(root(), &builder);
+  return builder.take();
+}
+
+void Tree::_emit(Index index, TreeBuilder* builder) const {
+  //  only scope keys need a copy, to put the prefix back
+  string scopeKey;
+  if (_nodes[index].isScope) scopeKey = CConfScopeKeyPrefix + key(index);
+  const string& k = _nodes[index].isScope ? scopeKey : key(index);
+  if (isLeaf(index)) {
+    builder->value(k, value(index));
+    return;
+  }
+
+  builder->startObject(k);
+  for (Index child = firstChild(index); child != InvalidIndex;
+       child = nextSibling(child)) {
+    _emit(child, builder);
+  }
+  builder->endObject();
+}
+
+#pragma mark TreeBuilder
+
+Tree::Index TreeBuilder::_add(const string& key) {
+  if (_stack.empty()) {
+    return _tree._addNode(Tree::InvalidIndex, _keyIndex(""), false);
+  }
+
+  bool isScope = Context::keyIsJsonScopeSpecifier(key);
+  Level& parent = _stack.back();
+  Tree::Index index = _tree._addNode(
+      parent.node,
+      _keyIndex(isScope ? Context::extractKeyFromJsonScopeSpecifier(key) : key),
+      isScope);
+
+  Tree::Node& parentNode = _tree._nodes[parent.node];
+  if (parent.lastChild == Tree::InvalidIndex) {
+    parentNode.firstChild = index;
+  } else {
+    _tree._nodes[parent.lastChild].nextSibling = index;
+  }
+  parentNode.childCount++;
+  parent.lastChild = index;
+  return index;
+}
+
+uint32_t TreeBuilder::_keyIndex(const string& key) {
+  auto itr = _keyIndices.find(key);
+  if (itr != _keyIndices.end()) return itr->second;
+  uint32_t index = _tree._addKey(key);
+  _keyIndices[key] = index;
+  return index;
+}
+
+void TreeBuilder::startObject(const string& key) {
+  Level level;
+  level.node = _add(key);
+  level.lastChild = Tree::InvalidIndex;
+  _stack.push_back(level);
+}
+
+void TreeBuilder::endObject() { _stack.pop_back(); }
+
+void TreeBuilder::value(const string& key, const Value& value) {
+  Tree::Index index = _add(key);
+  _tree._nodes[index].value = _tree._values.size();
+  _tree._values.push_back(value);
+}
+
+Tree TreeBuilder::take() {
+  Tree tree = std::move(_tree);
+  _tree = Tree();
+  _stack.clear();
+  _keyIndices.clear();
+  return tree;
+}
+
+#pragma mark Reading
+
+/// Replays a parsed document as parse events
+static void EmitJson(const string& key, const Json::Value& json,
+                     TreeBuilder* builder) {
+  if (json.type() != Json::objectValue) {
+    builder->value(key, Context::valueFromJson(json));
+    return;
+  }
+
+  builder->startObject(key);
+  for (Json::ValueConstIterator itr = json.begin(); itr != json.end(); itr++) {
+    EmitJson(itr.key().asString(), *itr, builder);
+  }
+  builder->endObject();
+}
+
+Tree ReadJson(const Json::Value& json) {
+  TreeBuilder builder;
+  EmitJson("", json, &builder);
+  return builder.take();
+}
+
+Tree ReadJsonStream(istream& in) {
+  TreeBuilder builder;
+  JsonStreamParser parser(in, &builder);
+  parser.parse();
+  return builder.take();
+}
+
+};  //  end namespace CConf
@@ -1,3 +1,5 @@
+#pragma once
+
 
 
 // Goals:
@@ -24,8 +26,6 @@
 // * Custom object types?
 //   * This probably can't be done with JSON :/... it would have to be XML
 
-// * implement iterators!
-
 // * Support many types
 //   * float, double
 //   * int
@@ -90,14 +90,179 @@
 
 */
 
-// to error: Wdelete-non-virtual-dtor
+#include <cstdint>
+#include <istream>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <json/json.h>
+#include "JsonStream.hpp"
+#include "Value.hpp"
+
+namespace CConf {
+
+class TreeBuilder;
+
+/// @brief Flat, contiguous snapshot of a single config file
+///
+/// @details All nodes of a file live in one vector and refer to each other by
+/// index.  Nodes are stored in document order, so each subtree is one
+/// contiguous run, and siblings are linked.  Each distinct key is stored once,
+/// in a key table that nodes refer to by index, and leaf values live in one
+/// value vector.  The Context keeps one Tree per loaded file and the values in
+/// its merged tree point into it, so unloading a file releases all of that
+/// file's storage at once.
+///
+/// A Tree is immutable once a Context holds it.  Transactions edit a copy (see
+/// findLeaf() and the methods after it) and swap that in.
+class Tree {
+ public:
+  typedef uint32_t Index;
+  static const Index InvalidIndex = UINT32_MAX;
+
+  struct Node {
+    Index parent;
+    /// first child; the rest follow through nextSibling
+    Index firstChild;
+    Index nextSibling;
+    Index childCount;
+    /// index into the key table
+    uint32_t key;
+    /// index into the value table, or InvalidIndex for objects
+    Index value;
+    /// whether the key was a scope specifier ('$$' prefix).  The prefix is
+    /// stripped from the stored key.
+    bool isScope;
+  };
+
+  Tree() {}
+
+  Index root() const { return 0; }
+  bool empty() const { return _nodes.empty(); }
+  size_t nodeCount() const { return _nodes.size(); }
+
+  const Node& node(Index index) const { return _nodes[index]; }
+  bool isLeaf(Index index) const { return _nodes[index].value != InvalidIndex; }
+
+  const std::string& key(Index index) const {
+    return _keys[_nodes[index].key];
+  }
+
+  Index firstChild(Index index) const { return _nodes[index].firstChild; }
+  Index nextSibling(Index index) const { return _nodes[index].nextSibling; }
+
+  const Value& value(Index index) const {
+    return _values[_nodes[index].value];
+  }
+
+  /// @brief The leaf holding the value for @keyPath under @scope
+  /// @details Keys and scopes may be interleaved in any way, as long as each
+  /// comes in order - the same rule mergeJson() applies.
+  /// @return the leaf's index or InvalidIndex if there isn't one
+  Index findLeaf(const std::vector<std::string>& keyPath,
+                 const std::vector<std::string>& scope) const;
+
+  /// Replaces the value of @leaf
+  void setValue(Index leaf, const Value& value);
+
+  /// @brief Add a leaf for @keyPath under @scope
+  /// @details Missing nodes are added after their siblings, with the scope's
+  /// nodes at the top of the tree.  Nothing is changed if the path runs into a
+  /// leaf or ends at an object.
+  /// @return the new leaf or InvalidIndex if the path conflicts with the tree
+  Index addLeaf(const std::vector<std::string>& keyPath,
+                const std::vector<std::string>& scope, const Value& value);
+
+  /// Detaches @leaf from its parent.  Its storage stays in the tree until it's
+  /// rebuilt with compacted().
+  void removeLeaf(Index leaf);
+
+  /// A copy in document order without the storage of removed leaves
+  Tree compacted() const;
+
+  /// Approximate heap memory held by this tree, including the payloads of long
+  /// strings and lists
+  size_t bytesUsed() const;
+
+  /// Writes the tree in a binary form that read() restores exactly.  Only
+  /// meant to be read back by the same build, see StartupCache.hpp.
+  void write(std::ostream& out) const;
+
+  /// Reads a tree written by write().  Returns false if @in is truncated or
+  /// doesn't hold a consistent tree.
+  static bool read(std::istream& in, Tree* treeOut);
+
+ private:
+  friend class TreeBuilder;
+
+  Index _addNode(Index parent, uint32_t key, bool isScope);
+
+  /// Adds @key to the key table.  Doesn't check for duplicates, TreeBuilder
+  /// does that.
+  uint32_t _addKey(const std::string& key) {
+    _keys.push_back(key);
+    return _keys.size() - 1;
+  }
+
+  /// Adds a node after the last child of @parent
+  Index _appendChild(Index parent, const std::string& key, bool isScope);
+
+  /// The child of @parent with the given key and kind, or InvalidIndex
+  Index _child(Index parent, const std::string& key, bool isScope) const;
+
+  bool _keyIs(Index index, const std::string& key) const {
+    return _keys[_nodes[index].key] == key;
+  }
+
+  Index _findLeaf(Index index, const std::vector<std::string>& keyPath,
+                  size_t key, const std::vector<std::string>& scope,
+                  size_t level) const;
+
+  /// Replays the subtree at @index as parse events
+  void _emit(Index index, TreeBuilder* builder) const;
+
+  std::vector<Node> _nodes;
+  std::vector<std::string> _keys;
+  std::vector<Value> _values;
+};
+
+/// @brief Builds a Tree from json parse events
+/// @details Handles '$$' scope keys as the events arrive: they're stored
+/// without the prefix and flagged as scopes.
+class TreeBuilder : public JsonHandler {
+ public:
+  TreeBuilder() {}
+
+  void startObject(const std::string& key) override;
+  void endObject() override;
+  void value(const std::string& key, const Value& value) override;
+
+  /// Returns the finished tree, leaving the builder empty
+  Tree take();
+
+ private:
+  Tree::Index _add(const std::string& key);
+
+  /// The key table index of @key, adding it the first time it's seen
+  uint32_t _keyIndex(const std::string& key);
 
-class Node {};
+  struct Level {
+    Tree::Index node;
+    Tree::Index lastChild;
+  };
 
-class ValueNode : public Node {};
+  Tree _tree;
+  std::vector<Level> _stack;
+  std::unordered_map<std::string, uint32_t> _keyIndices;
+};
 
-class BranchNode : public Node {};
+/// Builds a flat Tree from a parsed json document
+Tree ReadJson(const Json::Value& json);
 
-class Tree {};
+/// Builds a flat Tree straight from a json stream without building a
+/// Json::Value document first.  Throws a std::runtime_error if the json is
+/// malformed.
+Tree ReadJsonStream(std::istream& in);
 
-Tree ReadJson(const Json::Value& json) { return Tree(); }
+};  //  end namespace CConf
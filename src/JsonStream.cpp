@@ -0,0 +1,281 @@
+#include "JsonStream.hpp"
+#include <cerrno>
+#include <climits>
+#include <cstdlib>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+namespace CConf {
+
+JsonStreamParser::JsonStreamParser(istream& in, JsonHandler* handler)
+    : _buf(in.rdbuf()), _handler(handler), _line(1), _column(1) {}
+
+void JsonStreamParser::parse() {
+  if (!_buf) _fail("unable to read input");
+
+  _skipWhitespace();
+  _parseMember("");
+  _skipWhitespace();
+  if (_peek() != EOF) _fail("unexpected data after the document root");
+}
+
+int JsonStreamParser::_peek() { return _buf->sgetc(); }
+
+int JsonStreamParser::_get() {
+  int c = _buf->sbumpc();
+  if (c == '\n') {
+    _line++;
+    _column = 1;
+  } else {
+    _column++;
+  }
+  return c;
+}
+
+void JsonStreamParser::_skipWhitespace() {
+  while (true) {
+    int c = _peek();
+    if (c == ' ' || c == '\t' || c == '\n' || c == '\r') {
+      _get();
+    } else if (c == '/') {
+      _get();
+      int next = _get();
+      if (next == '/') {
+        while (_peek() != EOF && _peek() != '\n') _get();
+      } else if (next == '*') {
+        int prev = 0;
+        while (true) {
+          int cc = _get();
+          if (cc == EOF) _fail("unterminated comment");
+          if (prev == '*' && cc == '/') break;
+          prev = cc;
+        }
+      } else {
+        _fail("unexpected '/'");
+      }
+    } else {
+      return;
+    }
+  }
+}
+
+void JsonStreamParser::_expect(char c) {
+  if (_get() != c) _fail(string("expected '") + c + "'");
+}
+
+void JsonStreamParser::_fail(const string& message) {
+  throw runtime_error("failed to parse json: line " + to_string(_line) +
+                      ", column " + to_string(_column) + ": " + message);
+}
+
+void JsonStreamParser::_parseMember(const string& key) {
+  if (_peek() == '{') {
+    _handler->startObject(key);
+    _parseObjectBody();
+    _handler->endObject();
+  } else {
+    _handler->value(key, _parseLeafValue());
+  }
+}
+
+void JsonStreamParser::_parseObjectBody() {
+  _expect('{');
+  _skipWhitespace();
+  if (_peek() == '}') {
+    _get();
+    return;
+  }
+
+  while (true) {
+    _skipWhitespace();
+    if (_peek() != '"') _fail("expected an object key");
+    string key = _parseString();
+    _skipWhitespace();
+    _expect(':');
+    _skipWhitespace();
+    _parseMember(key);
+    _skipWhitespace();
+
+    int c = _get();
+    if (c == '}') return;
+    if (c != ',') _fail("expected ',' or '}'");
+  }
+}
+
+Value JsonStreamParser::_parseLeafValue() {
+  int c = _peek();
+  switch (c) {
+    case '"':
+      return Value(_parseString());
+    case 't':
+      _parseLiteral("true");
+      return Value(true);
+    case 'f':
+      _parseLiteral("false");
+      return Value(false);
+    case 'n':
+      _parseLiteral("null");
+      return Value();
+    case '{':
+      _fail("objects inside arrays are not supported");
+    case '[': {
+      _get();
+      vector<Value> lst;
+      _skipWhitespace();
+      if (_peek() == ']') {
+        _get();
+        return Value(std::move(lst));
+      }
+      while (true) {
+        _skipWhitespace();
+        lst.push_back(_parseLeafValue());
+        _skipWhitespace();
+        int next = _get();
+        if (next == ']') break;
+        if (next != ',') _fail("expected ',' or ']'");
+      }
+      return Value(std::move(lst));
+    }
+    default:
+      if (c == '-' || (c >= '0' && c <= '9')) return _parseNumber();
+      _fail("unexpected character");
+  }
+}
+
+void JsonStreamParser::_parseLiteral(const char* literal) {
+  for (const char* p = literal; *p; p++) {
+    if (_get() != *p) _fail(string("expected '") + literal + "'");
+  }
+}
+
+Value JsonStreamParser::_parseNumber() {
+  string text;
+  bool isReal = false;
+  while (true) {
+    int c = _peek();
+    if ((c >= '0' && c <= '9') || c == '-' || c == '+') {
+      text.push_back(_get());
+    } else if (c == '.' || c == 'e' || c == 'E') {
+      isReal = true;
+      text.push_back(_get());
+    } else {
+      break;
+    }
+  }
+
+  char* end;
+  errno = 0;
+  if (!isReal) {
+    long long value = strtoll(text.c_str(), &end, 10);
+    if (*end == '\0' && errno == 0) {
+      if (value >= INT_MIN && value <= INT_MAX) return Value((int)value);
+      if (value >= 0 && value <= UINT_MAX) return Value((unsigned)value);
+      return Value((int64_t)value);
+    }
+    //  only unsigned values fit past INT64_MAX
+    errno = 0;
+    if (text[0] != '-') {
+      unsigned long long u = strtoull(text.c_str(), &end, 10);
+      if (*end == '\0' && errno == 0) return Value((uint64_t)u);
+    }
+    errno = 0;
+  }
+
+  double value = strtod(text.c_str(), &end);
+  if (*end != '\0' || text.empty()) _fail("invalid number '" + text + "'");
+  return Value(value);
+}
+
+string JsonStreamParser::_parseString() {
+  _expect('"');
+  string out;
+  while (true) {
+    int c = _get();
+    if (c == EOF) _fail("unterminated string");
+    if (c == '"') return out;
+    if (c != '\\') {
+      out.push_back(c);
+      continue;
+    }
+
+    c = _get();
+    switch (c) {
+      case '"':
+      case '\\':
+      case '/':
+        out.push_back(c);
+        break;
+      case 'b':
+        out.push_back('\b');
+        break;
+      case 'f':
+        out.push_back('\f');
+        break;
+      case 'n':
+        out.push_back('\n');
+        break;
+      case 'r':
+        out.push_back('\r');
+        break;
+      case 't':
+        out.push_back('\t');
+        break;
+      case 'u': {
+        unsigned codePoint = _parseHex4();
+        if (codePoint >= 0xD800 && codePoint <= 0xDBFF) {
+          //  surrogate pair
+          _expect('\\');
+          _expect('u');
+          unsigned low = _parseHex4();
+          if (low < 0xDC00 || low > 0xDFFF) _fail("invalid surrogate pair");
+          codePoint = 0x10000 + ((codePoint - 0xD800) << 10) + (low - 0xDC00);
+        }
+        _appendUtf8(codePoint, &out);
+        break;
+      }
+      default:
+        _fail("invalid escape sequence");
+    }
+  }
+}
+
+unsigned JsonStreamParser::_parseHex4() {
+  unsigned value = 0;
+  for (int i = 0; i < 4; i++) {
+    int h = _get();
+    value <<= 4;
+    if (h >= '0' && h <= '9') {
+      value |= h - '0';
+    } else if (h >= 'a' && h <= 'f') {
+      value |= h - 'a' + 10;
+    } else if (h >= 'A' && h <= 'F') {
+      value |= h - 'A' + 10;
+    } else {
+      _fail("invalid unicode escape");
+    }
+  }
+  return value;
+}
+
+void JsonStreamParser::_appendUtf8(unsigned codePoint, string* out) {
+  if (codePoint < 0x80) {
+    out->push_back(codePoint);
+  } else if (codePoint < 0x800) {
+    out->push_back(0xC0 | (codePoint >> 6));
+    out->push_back(0x80 | (codePoint & 0x3F));
+  } else if (codePoint < 0x10000) {
+    out->push_back(0xE0 | (codePoint >> 12));
+    out->push_back(0x80 | ((codePoint >> 6) & 0x3F));
+    out->push_back(0x80 | (codePoint & 0x3F));
+  } else {
+    out->push_back(0xF0 | (codePoint >> 18));
+    out->push_back(0x80 | ((codePoint >> 12) & 0x3F));
+    out->push_back(0x80 | ((codePoint >> 6) & 0x3F));
+    out->push_back(0x80 | (codePoint & 0x3F));
+  }
+}
+
+};  //  end namespace CConf
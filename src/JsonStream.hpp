@@ -0,0 +1,65 @@
+#pragma once
+
+#include <istream>
+#include <string>
+#include "Value.hpp"
+
+namespace CConf {
+
+/// @brief Receives parse events from a JsonStreamParser
+///
+/// @details Objects are reported as start/end pairs.  Everything else,
+/// including arrays, arrives as a single leaf value.  Keys are passed exactly
+/// as they appear in the file, scope prefix included.
+class JsonHandler {
+ public:
+  virtual ~JsonHandler() {}
+
+  /// @key is empty for the root object
+  virtual void startObject(const std::string& key) = 0;
+  virtual void endObject() = 0;
+
+  /// @key is empty if the document root is not an object
+  virtual void value(const std::string& key, const Value& value) = 0;
+};
+
+/// @brief Event-based (SAX-style) json parser
+///
+/// @details Reads the stream one character at a time and hands each object and
+/// value to a JsonHandler as soon as it's complete, so no document tree is
+/// ever built.  Extra memory is bounded by the nesting depth and the largest
+/// single value.  Like Json::Reader it accepts // and /* */ comments.
+///
+/// Leaf values are converted the same way Context::valueFromJson()
+/// converts them.  Objects nested inside arrays aren't supported.
+class JsonStreamParser {
+ public:
+  JsonStreamParser(std::istream& in, JsonHandler* handler);
+
+  /// Parses the whole document.  Throws a std::runtime_error with the line and
+  /// column on malformed input.
+  void parse();
+
+ private:
+  int _peek();
+  int _get();
+  void _skipWhitespace();
+  void _expect(char c);
+  [[noreturn]] void _fail(const std::string& message);
+
+  void _parseMember(const std::string& key);
+  void _parseObjectBody();
+  Value _parseLeafValue();
+  std::string _parseString();
+  Value _parseNumber();
+  void _parseLiteral(const char* literal);
+  unsigned _parseHex4();
+  void _appendUtf8(unsigned codePoint, std::string* out);
+
+  std::streambuf* _buf;
+  JsonHandler* _handler;
+  int _line;
+  int _column;
+};
+
+};  //  end namespace CConf
@@ -0,0 +1,142 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+
+namespace CConf {
+
+/// 64-bit FNV-1a hash.  Usable at compile time and used by SymbolTable at
+/// runtime, so precomputed hashes can be used to look up symbols.
+constexpr uint64_t HashString(const char* str, size_t len,
+                              uint64_t hash = 14695981039346656037ull) {
+  return len == 0 ? hash : HashString(str + 1, len - 1,
+                                      (hash ^ (uint8_t)str[0]) *
+                                          1099511628211ull);
+}
+
+/// @brief A dotted key path that is split and hashed at compile time
+///
+/// @details Declare key paths as constexpr so the checks and hashing happen
+/// during compilation:
+///
+///     constexpr CConf::KeyPath MaxAccel("motion.max_accel");
+///
+/// An empty segment ("motion..max_accel"), a scope specifier as a segment
+/// ("$$robot17.max_vel") or more than MaxSegments segments is then a compile
+/// error instead of a lookup that silently fails.
+///
+/// Lookups through a KeyPath start from the precomputed segment hashes and
+/// never hash or copy the key strings.
+class KeyPath {
+ public:
+  static const size_t MaxSegments = 8;
+
+  struct Segment {
+    size_t offset;
+    size_t length;
+    uint64_t hash;
+  };
+
+  /// The empty key path, which has no segments and names nothing
+  constexpr KeyPath()
+      : _str(""),
+        _length(0),
+        _segmentCount(0),
+        _hash(HashString("", 0)),
+        _segments{} {}
+
+  template <size_t N>
+  constexpr explicit KeyPath(const char (&str)[N])
+      : _str(str),
+        _length(N - 1),
+        _segmentCount(_validate(str, N - 1)),
+        _hash(HashString(str, N - 1)),
+        _segments{_segment(str, N - 1, 0), _segment(str, N - 1, 1),
+                  _segment(str, N - 1, 2), _segment(str, N - 1, 3),
+                  _segment(str, N - 1, 4), _segment(str, N - 1, 5),
+                  _segment(str, N - 1, 6), _segment(str, N - 1, 7)} {}
+
+  constexpr const char* str() const { return _str; }
+  constexpr size_t length() const { return _length; }
+  constexpr bool empty() const { return _segmentCount == 0; }
+  std::string toString() const { return std::string(_str, _length); }
+
+  /// hash of the whole path
+  constexpr uint64_t hash() const { return _hash; }
+
+  constexpr size_t segmentCount() const { return _segmentCount; }
+  constexpr const Segment& segment(size_t i) const { return _segments[i]; }
+  constexpr const char* segmentStr(size_t i) const {
+    return _str + _segments[i].offset;
+  }
+
+ private:
+  static constexpr size_t _segmentStart(const char* s, size_t len,
+                                        size_t index, size_t pos = 0) {
+    return index == 0 ? pos
+                      : pos >= len ? len
+                                   : s[pos] == '.'
+                                         ? _segmentStart(s, len, index - 1,
+                                                         pos + 1)
+                                         : _segmentStart(s, len, index,
+                                                         pos + 1);
+  }
+
+  static constexpr size_t _segmentEnd(const char* s, size_t len, size_t pos) {
+    return (pos >= len || s[pos] == '.') ? pos : _segmentEnd(s, len, pos + 1);
+  }
+
+  static constexpr Segment _makeSegment(const char* s, size_t start,
+                                        size_t end) {
+    return Segment{start, end - start, HashString(s + start, end - start)};
+  }
+
+  static constexpr Segment _segment(const char* s, size_t len, size_t index) {
+    return index < _countSegments(s, len)
+               ? _makeSegment(s, _segmentStart(s, len, index),
+                              _segmentEnd(s, len, _segmentStart(s, len, index)))
+               : Segment{0, 0, 0};
+  }
+
+  static constexpr size_t _countSegments(const char* s, size_t len,
+                                         size_t pos = 0) {
+    return pos >= len
+               ? 1
+               : (s[pos] == '.' ? 1 : 0) + _countSegments(s, len, pos + 1);
+  }
+
+  /// whether the segment starting at @pos is empty or a scope specifier, or
+  /// any later one is
+  static constexpr bool _hasBadSegment(const char* s, size_t len,
+                                       size_t pos = 0) {
+    return pos >= len
+               ? true
+               : (s[pos] == '.' ||
+                  (s[pos] == '$' && pos + 1 < len && s[pos + 1] == '$'))
+                     ? true
+                     : _segmentEnd(s, len, pos) == len
+                           ? false
+                           : _hasBadSegment(s, len,
+                                            _segmentEnd(s, len, pos) + 1);
+  }
+
+  static constexpr size_t _validate(const char* s, size_t len) {
+    return _hasBadSegment(s, len)
+               ? throw std::invalid_argument(
+                     "Key path has an empty or scope segment")
+               : _countSegments(s, len) > MaxSegments
+                     ? throw std::invalid_argument(
+                           "Key path has too many segments")
+                     : _countSegments(s, len);
+  }
+
+  const char* _str;
+  size_t _length;
+  size_t _segmentCount;
+  uint64_t _hash;
+  Segment _segments[MaxSegments];
+};
+
+};  //  end namespace CConf
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace CConf {
+
+/// @brief Allocates objects of one type from large chunks
+///
+/// @details Objects are carved out of chunks of ChunkSize slots, so creating
+/// many of them costs one heap allocation per chunk instead of one each, and
+/// objects created together sit next to each other in memory.  Destroyed
+/// objects' slots go on a free list and are reused before a new chunk is
+/// allocated.  All chunks are released at once when the pool is destroyed.
+///
+/// The pool doesn't keep track of live objects: everything created has to be
+/// destroyed with destroy() before the pool goes away.  Not thread-safe.
+template <typename T, size_t ChunkSize = 256>
+class ObjectPool {
+ public:
+  ObjectPool() : _free(nullptr), _used(ChunkSize), _size(0) {}
+
+  ObjectPool(const ObjectPool&) = delete;
+  ObjectPool& operator=(const ObjectPool&) = delete;
+
+  template <typename... Args>
+  T* create(Args&&... args) {
+    Slot* slot = _allocate();
+    T* object;
+    try {
+      object = new (&slot->storage) T(std::forward<Args>(args)...);
+    } catch (...) {
+      _release(slot);
+      throw;
+    }
+    _size++;
+    return object;
+  }
+
+  /// Destroys @object, which must have come from create() on this pool
+  void destroy(T* object) {
+    object->~T();
+    _release(reinterpret_cast<Slot*>(object));
+    _size--;
+  }
+
+  /// number of live objects
+  size_t size() const { return _size; }
+
+  /// Heap memory held by the pool, including free slots
+  size_t bytesUsed() const { return _chunks.size() * ChunkSize * sizeof(Slot); }
+
+ private:
+  union Slot {
+    Slot* next;
+    typename std::aligned_storage<sizeof(T), alignof(T)>::type storage;
+  };
+
+  Slot* _allocate() {
+    if (_free) {
+      Slot* slot = _free;
+      _free = slot->next;
+      return slot;
+    }
+    if (_used == ChunkSize) {
+      _chunks.emplace_back(new Slot[ChunkSize]);
+      _used = 0;
+    }
+    return &_chunks.back()[_used++];
+  }
+
+  void _release(Slot* slot) {
+    slot->next = _free;
+    _free = slot;
+  }
+
+  std::vector<std::unique_ptr<Slot[]>> _chunks;
+  Slot* _free;
+  /// slots handed out from the last chunk
+  size_t _used;
+  size_t _size;
+};
+
+};  //  end namespace CConf
@@ -0,0 +1,297 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+#include "KeyPath.hpp"
+
+namespace CConf {
+
+/// @brief Immutable trie of values by dotted key path, with structural sharing
+///
+/// @details Each node is one segment of a key path.  A trie is never modified
+/// in place: an Editor builds a new version by copying the nodes on the paths
+/// to the key paths it changes, and shares every other node with the version
+/// it started from.  Making a change costs the length of the changed paths
+/// and the fan-out along them, not the size of the trie.
+///
+/// Subnodes are sorted by the HashString() of their key, so a lookup compares
+/// integers and only compares strings on a hash match.  Lookups by a KeyPath
+/// use its precomputed segment hashes and never hash anything.
+///
+/// Nodes are held by shared_ptrs, so each version stays valid for as long as
+/// something holds it, and all of them can be read from any thread.
+template <typename T>
+class PathTrie {
+ public:
+  struct Node;
+
+  struct Child {
+    uint64_t hash;
+    std::string key;
+    std::shared_ptr<Node> node;
+  };
+
+  struct Node {
+    Node() : hasValue(false), value(), size(0) {}
+
+    bool hasValue;
+    T value;
+    /// number of values in this subtree, including this node's
+    size_t size;
+    /// sorted by hash, then key
+    std::vector<Child> children;
+
+    /// @return the subnode for the key path segment @key with the given
+    /// HashString(), or nullptr
+    const Node* child(uint64_t hash, const char* key, size_t len) const {
+      size_t i = _position(children, hash, key, len);
+      return _matches(children, i, hash, key, len) ? children[i].node.get()
+                                                    : nullptr;
+    }
+  };
+
+  class Editor;
+
+  PathTrie() {}
+
+  const Node* root() const { return _root.get(); }
+
+  /// number of key paths with values
+  size_t size() const { return _root ? _root->size : 0; }
+
+  /// @return the node for the dotted @keyPath, which may or may not have a
+  /// value, or nullptr.  Doesn't allocate.
+  const Node* findNode(const std::string& keyPath) const {
+    const Node* node = _root.get();
+    size_t start = 0;
+    while (node && start <= keyPath.size()) {
+      size_t end = _segmentEnd(keyPath, start);
+      const char* key = keyPath.data() + start;
+      node = node->child(HashString(key, end - start), key, end - start);
+      start = end + 1;
+    }
+    return node;
+  }
+
+  const Node* findNode(const KeyPath& keyPath) const {
+    const Node* node = _root.get();
+    for (size_t i = 0; node && i < keyPath.segmentCount(); i++) {
+      const KeyPath::Segment& segment = keyPath.segment(i);
+      node = node->child(segment.hash, keyPath.segmentStr(i), segment.length);
+    }
+    return node;
+  }
+
+  /// @return the value at @keyPath or nullptr
+  template <typename Path>
+  const T* find(const Path& keyPath) const {
+    const Node* node = findNode(keyPath);
+    return node && node->hasValue ? &node->value : nullptr;
+  }
+
+  /// Calls @visitor(keyPath, value) for every value, in no particular order
+  template <typename Visitor>
+  void forEach(Visitor visitor) const {
+    std::string keyPath;
+    if (_root) _forEach(*_root, &keyPath, visitor);
+  }
+
+ private:
+  static size_t _segmentEnd(const std::string& keyPath, size_t start) {
+    size_t end = keyPath.find('.', start);
+    return end == std::string::npos ? keyPath.size() : end;
+  }
+
+  static int _compare(const Child& child, uint64_t hash, const char* key,
+                      size_t len) {
+    if (child.hash != hash) return child.hash < hash ? -1 : 1;
+    return child.key.compare(0, std::string::npos, key, len);
+  }
+
+  /// index of the first child that doesn't sort before (@hash, @key)
+  static size_t _position(const std::vector<Child>& children, uint64_t hash,
+                          const char* key, size_t len) {
+    size_t first = 0, count = children.size();
+    while (count > 0) {
+      size_t step = count / 2;
+      if (_compare(children[first + step], hash, key, len) < 0) {
+        first += step + 1;
+        count -= step + 1;
+      } else {
+        count = step;
+      }
+    }
+    return first;
+  }
+
+  static bool _matches(const std::vector<Child>& children, size_t i,
+                       uint64_t hash, const char* key, size_t len) {
+    return i < children.size() && _compare(children[i], hash, key, len) == 0;
+  }
+
+  template <typename Visitor>
+  static void _forEach(const Node& node, std::string* keyPath,
+                       Visitor& visitor) {
+    if (node.hasValue) visitor(*keyPath, node.value);
+    for (const Child& child : node.children) {
+      size_t length = keyPath->size();
+      if (length > 0) keyPath->push_back('.');
+      keyPath->append(child.key);
+      _forEach(*child.node, keyPath, visitor);
+      keyPath->resize(length);
+    }
+  }
+
+  std::shared_ptr<Node> _root;
+};
+
+/// @brief Builds a new version of a PathTrie
+///
+/// @details Nodes are copied the first time an edit passes through them and
+/// edited in place after that, so a batch of edits under the same prefix
+/// copies the prefix once.  The trie the editor started from is never
+/// modified.
+template <typename T>
+class PathTrie<T>::Editor {
+ public:
+  explicit Editor(const PathTrie& base) : _root(base._root) {}
+
+  /// Sets the value at @keyPath, adding nodes as needed
+  void set(const std::string& keyPath, const T& value) {
+    std::vector<Node*> path;
+    Node* node = _own(&_root);
+    path.push_back(node);
+    size_t start = 0;
+    while (start <= keyPath.size()) {
+      size_t end = _segmentEnd(keyPath, start);
+      const char* key = keyPath.data() + start;
+      size_t len = end - start;
+      uint64_t hash = HashString(key, len);
+      size_t i = _position(node->children, hash, key, len);
+      if (!_matches(node->children, i, hash, key, len)) {
+        Child child{hash, std::string(key, len), nullptr};
+        node->children.insert(node->children.begin() + i, std::move(child));
+      }
+      node = _own(&node->children[i].node);
+      path.push_back(node);
+      start = end + 1;
+    }
+
+    if (!node->hasValue) {
+      for (Node* n : path) n->size++;
+    }
+    node->hasValue = true;
+    node->value = value;
+  }
+
+  /// Removes the value at @keyPath along with the nodes that leaves empty
+  void erase(const std::string& keyPath) {
+    PathTrie current;
+    current._root = _root;
+    const Node* existing = current.findNode(keyPath);
+    if (!existing || !existing->hasValue) return;
+
+    //  the path exists, so this only copies.  Each level remembers its index
+    //  in its parent.
+    std::vector<std::pair<Node*, size_t>> path;
+    Node* node = _own(&_root);
+    path.push_back(std::make_pair(node, 0));
+    size_t start = 0;
+    while (start <= keyPath.size()) {
+      size_t end = _segmentEnd(keyPath, start);
+      const char* key = keyPath.data() + start;
+      size_t i = _position(node->children, HashString(key, end - start), key,
+                           end - start);
+      node = _own(&node->children[i].node);
+      path.push_back(std::make_pair(node, i));
+      start = end + 1;
+    }
+
+    node->hasValue = false;
+    node->value = T();
+    for (auto& level : path) level.first->size--;
+
+    for (size_t i = path.size() - 1; i > 0 && path[i].first->size == 0; i--) {
+      std::vector<Child>& siblings = path[i - 1].first->children;
+      _owned.erase(path[i].first);
+      siblings.erase(siblings.begin() + path[i].second);
+    }
+    if (_root->size == 0) {
+      _owned.erase(_root.get());
+      _root.reset();
+    }
+  }
+
+  /// @brief Share equal subtrees with another trie
+  /// @details Replaces each node this editor copied or added with the node at
+  /// the same key path in @other if the two are equal: the same value and the
+  /// very same subnodes.  Only the nodes on edited paths are compared.
+  void shareWith(const PathTrie& other) {
+    if (_root && _owned.count(_root.get())) _share(&_root, other._root);
+  }
+
+  /// The edited trie.  The editor is empty afterwards.
+  PathTrie finish() {
+    PathTrie trie;
+    trie._root = std::move(_root);
+    _owned.clear();
+    return trie;
+  }
+
+ private:
+  /// @node's target if this editor already owns it, otherwise replaces it
+  /// with a copy (or a new node if it's null) that it owns
+  Node* _own(std::shared_ptr<Node>* node) {
+    if (*node && _owned.count(node->get())) return node->get();
+    *node = *node ? std::make_shared<Node>(**node) : std::make_shared<Node>();
+    _owned.insert(node->get());
+    return node->get();
+  }
+
+  void _share(std::shared_ptr<Node>* node, const std::shared_ptr<Node>& other) {
+    Node* n = node->get();
+    for (Child& child : n->children) {
+      if (!_owned.count(child.node.get())) continue;
+      std::shared_ptr<Node> otherChild;
+      if (other) {
+        const char* key = child.key.data();
+        size_t len = child.key.size();
+        size_t i = _position(other->children, child.hash, key, len);
+        if (_matches(other->children, i, child.hash, key, len)) {
+          otherChild = other->children[i].node;
+        }
+      }
+      _share(&child.node, otherChild);
+    }
+
+    if (other && _sameNode(*n, *other)) {
+      _owned.erase(n);
+      *node = other;
+    }
+  }
+
+  static bool _sameNode(const Node& a, const Node& b) {
+    if (a.hasValue != b.hasValue || (a.hasValue && !(a.value == b.value)) ||
+        a.children.size() != b.children.size()) {
+      return false;
+    }
+    for (size_t i = 0; i < a.children.size(); i++) {
+      if (a.children[i].hash != b.children[i].hash ||
+          a.children[i].node != b.children[i].node) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  std::shared_ptr<Node> _root;
+  /// nodes this editor created, which it may modify in place
+  std::unordered_set<const Node*> _owned;
+};
+
+};  //  end namespace CConf
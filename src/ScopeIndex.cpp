@@ -0,0 +1,143 @@
+#include "ScopeIndex.hpp"
+#include "ConfigContext.hpp"
+#include <algorithm>
+
+using namespace std;
+
+namespace CConf {
+
+void ScopeIndex::insert(const ScopedValue& value, const Context* context) {
+  ScopeIndex* level = this;
+  for (Symbol name : value.scope()) {
+    unique_ptr<ScopeIndex>& sub = level->_subscopes[name];
+    if (!sub) sub.reset(new ScopeIndex());
+    level = sub.get();
+  }
+
+  vector<ScopedValue>& values = level->_values;
+  for (size_t i = 0; i < values.size(); i++) {
+    if (values[i].filePath() == value.filePath()) {
+      values.erase(values.begin() + i);
+      break;
+    }
+  }
+
+  int priority = context->priorityOfFile(value.filePath());
+  auto pos = std::upper_bound(
+      values.begin(), values.end(), priority,
+      [&](int p, const ScopedValue& v) {
+        return p < context->priorityOfFile(v.filePath());
+      });
+  values.insert(pos, value);
+}
+
+ScopeIndex* ScopeIndex::_level(const vector<Symbol>& scope, size_t depth) {
+  if (depth == scope.size()) return this;
+  auto itr = _subscopes.find(scope[depth]);
+  return itr != _subscopes.end() ? itr->second->_level(scope, depth + 1)
+                                 : nullptr;
+}
+
+bool ScopeIndex::remove(Symbol filePath, const vector<Symbol>& scope) {
+  if (scope.empty()) {
+    for (size_t i = 0; i < _values.size(); i++) {
+      if (_values[i].filePath() == filePath) {
+        _values.erase(_values.begin() + i);
+        return true;
+      }
+    }
+    return false;
+  }
+
+  auto itr = _subscopes.find(scope[0]);
+  if (itr == _subscopes.end()) return false;
+
+  vector<Symbol> rest(scope.begin() + 1, scope.end());
+  bool removed = itr->second->remove(filePath, rest);
+  if (itr->second->empty()) _subscopes.erase(itr);
+  return removed;
+}
+
+bool ScopeIndex::rebind(const ScopedValue& value) {
+  ScopeIndex* level = _level(value.scope());
+  if (!level) return false;
+
+  for (ScopedValue& v : level->_values) {
+    if (v.filePath() == value.filePath()) {
+      v = value;
+      return true;
+    }
+  }
+  return false;
+}
+
+bool ScopeIndex::removeValuesFromFile(Symbol filePath) {
+  size_t oldSize = _values.size();
+  _values.erase(std::remove_if(_values.begin(), _values.end(),
+                               [&](const ScopedValue& v) {
+                                 return v.filePath() == filePath;
+                               }),
+                _values.end());
+  bool removed = _values.size() != oldSize;
+
+  for (auto itr = _subscopes.begin(); itr != _subscopes.end();) {
+    if (itr->second->removeValuesFromFile(filePath)) removed = true;
+    if (itr->second->empty()) {
+      itr = _subscopes.erase(itr);
+    } else {
+      ++itr;
+    }
+  }
+
+  return removed;
+}
+
+const ScopedValue* ScopeIndex::_best(Symbol filePath) const {
+  if (filePath == InvalidSymbol) {
+    return _values.empty() ? nullptr : &_values.back();
+  }
+
+  for (const ScopedValue& v : _values) {
+    if (v.filePath() == filePath) return &v;
+  }
+  return nullptr;
+}
+
+const ScopedValue* ScopeIndex::find(const vector<Symbol>& scope,
+                                    Symbol filePath) const {
+  const ScopedValue* best = _best(filePath);
+  const ScopeIndex* level = this;
+  for (Symbol name : scope) {
+    auto itr = level->_subscopes.find(name);
+    if (itr == level->_subscopes.end()) break;
+    level = itr->second.get();
+
+    const ScopedValue* candidate = level->_best(filePath);
+    if (candidate) best = candidate;
+  }
+  return best;
+}
+
+void ScopeIndex::getScopeWinners(
+    vector<Symbol>* scope,
+    vector<pair<vector<Symbol>, const ScopedValue*>>* winnersOut) const {
+  if (!_values.empty()) {
+    winnersOut->push_back(make_pair(*scope, &_values.back()));
+  }
+  for (auto& itr : _subscopes) {
+    scope->push_back(itr.first);
+    itr.second->getScopeWinners(scope, winnersOut);
+    scope->pop_back();
+  }
+}
+
+void ScopeIndex::getValues(vector<const ScopedValue*>* valuesOut) const {
+  for (const ScopedValue& v : _values) {
+    valuesOut->push_back(&v);
+  }
+  for (auto& itr : _subscopes) {
+    itr.second->getValues(valuesOut);
+  }
+}
+
+};  //  end namespace CConf
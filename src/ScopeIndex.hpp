@@ -0,0 +1,76 @@
+#pragma once
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include "SymbolTable.hpp"
+
+namespace CConf {
+
+class Context;
+class ScopedValue;
+
+/// @brief The values of a leaf, indexed by scope
+///
+/// @details This is a trie over (interned) scope names.  The root holds the
+/// values for the default scope, its child "2008" the values for {"2008"}, and
+/// so on.
+/// Each level keeps its values ordered by ascending file priority, so the
+/// winner for a scope is the last value of the deepest level on the path that
+/// has any values.  Resolving is O(scope depth * log(fan-out)) regardless of
+/// how many scopes or files define the key.
+///
+/// Relative file priorities never change while a file is in the context
+/// (removing a file keeps the order of the others and new files go on top), so
+/// the ordering only has to be established on insertion.
+class ScopeIndex {
+ public:
+  /// Inserts @value, replacing any value from the same file under the same
+  /// scope.  @context is used to look up file priorities.
+  void insert(const ScopedValue& value, const Context* context);
+
+  /// Removes the value @filePath defined under @scope.  Prunes levels left
+  /// empty.
+  /// @return whether there was such a value
+  bool remove(Symbol filePath, const std::vector<Symbol>& scope);
+
+  /// Replaces the value from the same file under the same scope with @value
+  /// without changing its position.
+  /// @return false if there was no such value
+  bool rebind(const ScopedValue& value);
+
+  /// Removes all values from @filePath and prunes levels left empty.
+  /// @return whether anything was removed
+  bool removeValuesFromFile(Symbol filePath);
+
+  /// @brief Find the winning value for @scope
+  ///
+  /// @param scope the scope to resolve under
+  /// @param filePath if valid, only values from this file are considered
+  /// @return the most specific, highest priority value or nullptr
+  const ScopedValue* find(const std::vector<Symbol>& scope,
+                          Symbol filePath = InvalidSymbol) const;
+
+  /// Appends pointers to all values in the index to @valuesOut
+  void getValues(std::vector<const ScopedValue*>* valuesOut) const;
+
+  /// Appends the scope and top value of every level that has values.
+  /// @scope is the scope of this level and is restored before returning.
+  void getScopeWinners(
+      std::vector<Symbol>* scope,
+      std::vector<std::pair<std::vector<Symbol>, const ScopedValue*>>*
+          winnersOut) const;
+
+  bool empty() const { return _values.empty() && _subscopes.empty(); }
+
+ private:
+  const ScopedValue* _best(Symbol filePath) const;
+  ScopeIndex* _level(const std::vector<Symbol>& scope, size_t depth = 0);
+
+  /// values for exactly this scope, ascending file priority
+  std::vector<ScopedValue> _values;
+  std::map<Symbol, std::unique_ptr<ScopeIndex>> _subscopes;
+};
+
+};  //  end namespace CConf
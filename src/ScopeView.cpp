@@ -0,0 +1,78 @@
+#include "ScopeView.hpp"
+
+using namespace std;
+
+namespace CConf {
+
+typedef PathTrie<Value>::Node ValueTrieNode;
+
+static bool SameValue(const Value* a, const Value* b) {
+  if (!a || !b) return a == b;
+  return *a == *b;
+}
+
+/// Number of values in the subtrees @a has in common with @b at the same key
+/// paths
+static size_t SharedValues(const ValueTrieNode* a, const ValueTrieNode* b) {
+  if (!a || !b) return 0;
+  if (a == b) return a->size;
+
+  size_t shared = 0;
+  for (const PathTrie<Value>::Child& child : a->children) {
+    shared += SharedValues(
+        child.node.get(),
+        b->child(child.hash, child.key.data(), child.key.size()));
+  }
+  return shared;
+}
+
+size_t ScopeView::sharedKeyPaths(const ScopeView& other) const {
+  return SharedValues(_values.root(), other._values.root());
+}
+
+shared_ptr<const ScopeView> ScopeView::build(const Snapshot& snapshot,
+                                             const vector<string>& scope,
+                                             const ScopeView* defaultView) {
+  ScopeView empty;
+  empty._scope = scope;
+
+  vector<string> keyPaths;
+  keyPaths.reserve(snapshot._leaves.size());
+  snapshot._leaves.forEach(
+      [&keyPaths](const string& keyPath, const Snapshot::Entry&) {
+        keyPaths.push_back(keyPath);
+      });
+
+  //  every key path is a change from an empty view
+  return update(empty, snapshot, keyPaths, defaultView);
+}
+
+shared_ptr<const ScopeView> ScopeView::update(const ScopeView& prev,
+                                              const Snapshot& snapshot,
+                                              const vector<string>& changed,
+                                              const ScopeView* defaultView) {
+  shared_ptr<ScopeView> next = make_shared<ScopeView>();
+  next->_scope = prev._scope;
+  next->_version = snapshot.version();
+
+  PathTrie<Value>::Editor editor(prev._values);
+  for (const string& keyPath : changed) {
+    const Value* value = snapshot.value(keyPath, prev._scope);
+    //  a key path can change in the snapshot without changing under this
+    //  scope, and then its nodes stay shared with @prev
+    if (SameValue(value, prev._values.find(keyPath))) continue;
+    if (value) {
+      editor.set(keyPath, *value);
+    } else {
+      editor.erase(keyPath);
+    }
+  }
+
+  //  Subtrees that weren't edited are as shared with the default view as they
+  //  were before, since the default view only changed along @changed too.
+  if (defaultView) editor.shareWith(defaultView->_values);
+  next->_values = editor.finish();
+  return next;
+}
+
+};  //  end namespace CConf
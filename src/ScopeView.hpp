@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include "PathTrie.hpp"
+#include "Snapshot.hpp"
+#include "Value.hpp"
+
+namespace CConf {
+
+/// @brief The resolved configuration for one scope, flattened
+///
+/// @details Looking a value up in a Snapshot walks the scope trie of its leaf
+/// on every call.  A ScopeView does that resolution once for every key path,
+/// so a lookup only walks the key path.  Get one with Context::view(), which
+/// keeps it up to date by re-resolving only the key paths that changed.
+///
+/// The values are a PathTrie.  Updating a view copies the trie nodes on the
+/// changed key paths and shares the rest with the previous version, and any
+/// subtree that resolves the same as in the default scope is shared with the
+/// default-scope view, down to single values.  A view only costs memory for
+/// the key paths its scope overrides and the nodes above them.
+///
+/// Like a Snapshot, a ScopeView is immutable and safe to read from any thread.
+class ScopeView {
+ public:
+  ScopeView() : _version(0) {}
+
+  /// @return the value resolved for @keyPath under scope(), or nullptr.  The
+  /// value lives as long as the view.
+  const Value* value(const std::string& keyPath) const {
+    return _values.find(keyPath);
+  }
+
+  const std::vector<std::string>& scope() const { return _scope; }
+
+  /// Version of the snapshot the view was resolved from
+  uint64_t version() const { return _version; }
+
+  /// number of key paths with values
+  size_t size() const { return _values.size(); }
+
+  /// Number of key paths whose values this view shares with @other rather
+  /// than holding its own copy of
+  size_t sharedKeyPaths(const ScopeView& other) const;
+
+ private:
+  friend class Context;
+
+  /// Resolves every key path in @snapshot under @scope.  Subtrees equal to
+  /// the ones of @defaultView are shared with it.
+  static std::shared_ptr<const ScopeView> build(
+      const Snapshot& snapshot, const std::vector<std::string>& scope,
+      const ScopeView* defaultView);
+
+  /// @brief Re-resolve the key paths that changed since @prev was built
+  ///
+  /// @param prev the view to update.  It isn't modified.
+  /// @param snapshot the snapshot to resolve from
+  /// @param changed the key paths that were added, removed or changed
+  /// @param defaultView the default-scope view, already updated to
+  /// @snapshot, or nullptr when updating the default-scope view
+  static std::shared_ptr<const ScopeView> update(
+      const ScopeView& prev, const Snapshot& snapshot,
+      const std::vector<std::string>& changed, const ScopeView* defaultView);
+
+  std::vector<std::string> _scope;
+  uint64_t _version;
+  PathTrie<Value> _values;
+};
+
+};  //  end namespace CConf
@@ -0,0 +1,32 @@
+#include "Snapshot.hpp"
+
+using namespace std;
+
+namespace CConf {
+
+const Value* Snapshot::value(const string& keyPath,
+                             const vector<string>& scope) const {
+  return _resolve(_leaves.find(keyPath), scope);
+}
+
+const Value* Snapshot::value(const KeyPath& keyPath,
+                             const vector<string>& scope) const {
+  return _resolve(_leaves.find(keyPath), scope);
+}
+
+const Value* Snapshot::_resolve(const Entry* entry,
+                                const vector<string>& scope) {
+  if (!entry) return nullptr;
+
+  const Leaf* level = entry->leaf.get();
+  const Value* best = level->hasValue ? &level->value : nullptr;
+  for (const string& name : scope) {
+    auto sub = level->subscopes.find(name);
+    if (sub == level->subscopes.end()) break;
+    level = sub->second.get();
+    if (level->hasValue) best = &level->value;
+  }
+  return best;
+}
+
+};  //  end namespace CConf
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include "BinaryImage.hpp"
+#include "KeyPath.hpp"
+#include "PathTrie.hpp"
+#include "Value.hpp"
+
+namespace CConf {
+
+/// @brief Immutable, self-contained copy of the resolved configuration
+///
+/// @details A Context publishes a new Snapshot after every change to its tree
+/// (adding, removing or reloading a file).  Readers on any thread get the
+/// current one with Context::snapshot() and can keep using it for as long as
+/// they hold the pointer, regardless of reloads happening in the meantime.
+/// The snapshot is freed once the last reader lets go of it.
+///
+/// A Snapshot doesn't refer back to the Context (not even its symbol table),
+/// so it's safe to read concurrently with any mutation of the Context.
+/// Snapshots are a PathTrie of leaves: publishing one copies the leaves that
+/// changed and the trie nodes above them, and shares everything else with the
+/// previous snapshot.
+class Snapshot {
+ public:
+  /// The values of one key path: the winning value for each scope that has
+  /// one, as a trie over scope names.
+  struct Leaf {
+    Leaf() : hasValue(false) {}
+
+    bool hasValue;
+    Value value;
+    std::map<std::string, std::unique_ptr<Leaf>> subscopes;
+  };
+
+  Snapshot() : _version(0) {}
+
+  /// @brief Look up the resolved value for a key path
+  ///
+  /// @param keyPath dot-separated path, e.g. "motion.max_accel"
+  /// @param scope the scope to resolve under, e.g. {"2008", "robot17"}
+  /// @return the winning value or nullptr if nothing is defined for @keyPath.
+  /// The value lives as long as the snapshot.
+  const Value* value(const std::string& keyPath,
+                     const std::vector<std::string>& scope = {}) const;
+
+  /// Same as above, but finds each segment by its precomputed hash
+  const Value* value(const KeyPath& keyPath,
+                     const std::vector<std::string>& scope = {}) const;
+
+  /// The image the Context serves from (see Context::loadImage()), or nullptr.
+  /// When set, value() finds nothing and lookups go to the image instead.
+  const BinaryImage* image() const { return _image.get(); }
+
+  /// Increases by one with every snapshot a Context publishes
+  uint64_t version() const { return _version; }
+
+  /// number of key paths with values
+  size_t size() const { return _leaves.size(); }
+
+ private:
+  friend class Context;
+  friend class ScopeView;
+
+  struct Entry {
+    Entry() : generation(0) {}
+
+    /// ValueNode::generation() of the leaf this was built from
+    uint64_t generation;
+    std::shared_ptr<const Leaf> leaf;
+  };
+
+  /// the winning value in @entry (which may be null) under @scope
+  static const Value* _resolve(const Entry* entry,
+                               const std::vector<std::string>& scope);
+
+  uint64_t _version;
+  /// by key path
+  PathTrie<Entry> _leaves;
+  std::shared_ptr<const BinaryImage> _image;
+};
+
+};  //  end namespace CConf
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+#include <vector>
+
+namespace CConf {
+
+/// @brief Read-only view of a contiguous array
+/// @details Doesn't own the elements - whatever it was taken from has to
+/// outlive it.
+template <typename T>
+class Span {
+ public:
+  Span() : _data(nullptr), _size(0) {}
+  Span(const T* data, size_t size) : _data(data), _size(size) {}
+
+  const T* data() const { return _data; }
+  size_t size() const { return _size; }
+  bool empty() const { return _size == 0; }
+
+  const T* begin() const { return _data; }
+  const T* end() const { return _data + _size; }
+  const T& operator[](size_t i) const { return _data[i]; }
+
+ private:
+  const T* _data;
+  size_t _size;
+};
+
+/// @brief Allocator for buffers that start on a cache line boundary
+/// @details The alignment is enough for any SIMD load, so loops over the
+/// buffer vectorize without a scalar prologue.
+template <typename T>
+class AlignedAllocator {
+ public:
+  typedef T value_type;
+
+  static const size_t Alignment = 64;
+
+  AlignedAllocator() {}
+  template <typename U>
+  AlignedAllocator(const AlignedAllocator<U>&) {}
+
+  T* allocate(size_t n) {
+    void* p = nullptr;
+    if (posix_memalign(&p, Alignment, n * sizeof(T)) != 0) {
+      throw std::bad_alloc();
+    }
+    return (T*)p;
+  }
+  void deallocate(T* p, size_t) { free(p); }
+};
+
+template <typename T, typename U>
+bool operator==(const AlignedAllocator<T>&, const AlignedAllocator<U>&) {
+  return true;
+}
+template <typename T, typename U>
+bool operator!=(const AlignedAllocator<T>&, const AlignedAllocator<U>&) {
+  return false;
+}
+
+template <typename T>
+using AlignedVector = std::vector<T, AlignedAllocator<T>>;
+
+};  //  end namespace CConf
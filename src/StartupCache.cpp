@@ -0,0 +1,140 @@
+#include "StartupCache.hpp"
+#include <sys/stat.h>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+using namespace std;
+
+namespace CConf {
+
+static const char CacheMagic[8] = {'C', 'C', 'O', 'N', 'F', 'C', 'C', 'H'};
+/// bump whenever the layout of the cache or of Tree::write() changes
+static const uint32_t CacheVersion = 2;
+
+/// 64-bit FNV-1a, the same hash as HashString() but for large inputs
+static uint64_t HashContents(const char* data, size_t length) {
+  uint64_t hash = 14695981039346656037ull;
+  for (size_t i = 0; i < length; i++) {
+    hash = (hash ^ (uint8_t)data[i]) * 1099511628211ull;
+  }
+  return hash;
+}
+
+template <typename T>
+static void WritePod(ostream& out, T value) {
+  out.write((const char*)&value, sizeof(T));
+}
+
+template <typename T>
+static bool ReadPod(istream& in, T* valueOut) {
+  return (bool)in.read((char*)valueOut, sizeof(T));
+}
+
+static void WriteString(ostream& out, const string& str) {
+  WritePod<uint32_t>(out, str.size());
+  out.write(str.data(), str.size());
+}
+
+static bool ReadString(istream& in, string* strOut) {
+  uint32_t length;
+  if (!ReadPod(in, &length)) return false;
+  strOut->resize(length);
+  return length == 0 || (bool)in.read(&(*strOut)[0], length);
+}
+
+FileStamp StampFile(const string& path, string* contentsOut) {
+  ifstream in(path, ios::binary);
+  struct stat info;
+  if (!in || stat(path.c_str(), &info) != 0) {
+    throw runtime_error("failed to open file: " + path);
+  }
+  ostringstream contents;
+  contents << in.rdbuf();
+  *contentsOut = contents.str();
+
+  FileStamp stamp;
+  stamp.path = path;
+  stamp.size = contentsOut->size();
+  stamp.mtime = info.st_mtime;
+  stamp.hash = HashContents(contentsOut->data(), contentsOut->size());
+  return stamp;
+}
+
+bool LoadStartupCache(const string& cachePath, const vector<FileStamp>& stamps,
+                      vector<Tree>* treesOut) {
+  ifstream file(cachePath, ios::binary);
+  if (!file) return false;
+
+  char magic[sizeof(CacheMagic)];
+  uint32_t version;
+  uint64_t bodyHash;
+  if (!file.read(magic, sizeof(magic)) ||
+      memcmp(magic, CacheMagic, sizeof(magic)) != 0 ||
+      !ReadPod(file, &version) || version != CacheVersion ||
+      !ReadPod(file, &bodyHash)) {
+    return false;
+  }
+
+  //  the body is checked as a whole before any of it is trusted
+  ostringstream bodyStream;
+  bodyStream << file.rdbuf();
+  string body = bodyStream.str();
+  if (HashContents(body.data(), body.size()) != bodyHash) return false;
+  istringstream in(body);
+
+  uint32_t fileCount;
+  if (!ReadPod(in, &fileCount) || fileCount != stamps.size()) return false;
+  for (const FileStamp& expected : stamps) {
+    FileStamp cached;
+    if (!ReadString(in, &cached.path) || !ReadPod(in, &cached.size) ||
+        !ReadPod(in, &cached.mtime) || !ReadPod(in, &cached.hash) ||
+        cached != expected) {
+      return false;
+    }
+  }
+
+  vector<Tree> trees(stamps.size());
+  for (Tree& tree : trees) {
+    if (!Tree::read(in, &tree)) return false;
+  }
+  treesOut->swap(trees);
+  return true;
+}
+
+void WriteStartupCache(const string& cachePath, const vector<FileStamp>& stamps,
+                       const vector<const Tree*>& trees) {
+  ostringstream body;
+  WritePod<uint32_t>(body, stamps.size());
+  for (const FileStamp& stamp : stamps) {
+    WriteString(body, stamp.path);
+    WritePod(body, stamp.size);
+    WritePod(body, stamp.mtime);
+    WritePod(body, stamp.hash);
+  }
+  for (const Tree* tree : trees) tree->write(body);
+  string bodyData = body.str();
+
+  //  written next to the destination and renamed over it, so a process
+  //  starting concurrently never reads a partial cache
+  string tmpPath = cachePath + ".tmp";
+  {
+    ofstream out(tmpPath, ios::binary | ios::trunc);
+    out.write(CacheMagic, sizeof(CacheMagic));
+    WritePod(out, CacheVersion);
+    WritePod(out, HashContents(bodyData.data(), bodyData.size()));
+    out.write(bodyData.data(), bodyData.size());
+    if (!out) {
+      remove(tmpPath.c_str());
+      throw runtime_error("failed to write startup cache: " + tmpPath);
+    }
+  }
+  if (rename(tmpPath.c_str(), cachePath.c_str()) != 0) {
+    remove(tmpPath.c_str());
+    throw runtime_error("failed to replace startup cache: " + cachePath);
+  }
+}
+
+};  //  end namespace CConf
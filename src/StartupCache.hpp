@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "ConfigContext2.hpp"
+
+namespace CConf {
+
+/// @brief Identifies the exact contents of a config file
+/// @details Size and mtime alone can miss an edit made within the mtime's
+/// resolution, so the contents are hashed as well.
+struct FileStamp {
+  FileStamp() : size(0), mtime(0), hash(0) {}
+
+  std::string path;
+  uint64_t size;
+  /// seconds since the epoch
+  int64_t mtime;
+  /// 64-bit FNV-1a of the contents
+  uint64_t hash;
+
+  bool operator==(const FileStamp& other) const {
+    return path == other.path && size == other.size && mtime == other.mtime &&
+           hash == other.hash;
+  }
+  bool operator!=(const FileStamp& other) const { return !(*this == other); }
+};
+
+/// Reads the file at @path into @contentsOut and stamps it.  Throws a
+/// std::runtime_error if the file can't be read.
+FileStamp StampFile(const std::string& path, std::string* contentsOut);
+
+/// @brief Load the parsed files from a startup cache
+///
+/// @details A startup cache holds the parsed Trees of an ordered list of
+/// files, so a process that restarts with unchanged files can skip parsing
+/// them.  See Context::setStartupCache().
+///
+/// @param cachePath the cache file, written by WriteStartupCache()
+/// @param stamps the current stamps of the files, in priority order
+/// @param treesOut receives one tree per stamp on success
+/// @return false if the cache is missing, damaged, from a different build or
+/// was written for different files or file contents
+bool LoadStartupCache(const std::string& cachePath,
+                      const std::vector<FileStamp>& stamps,
+                      std::vector<Tree>* treesOut);
+
+/// Writes the cache for the files in @stamps and their parsed @trees.  The
+/// cache is replaced atomically.  Throws a std::runtime_error on failure.
+void WriteStartupCache(const std::string& cachePath,
+                       const std::vector<FileStamp>& stamps,
+                       const std::vector<const Tree*>& trees);
+
+};  //  end namespace CConf
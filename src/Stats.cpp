@@ -0,0 +1,129 @@
+#include "Stats.hpp"
+#include <sstream>
+
+using namespace std;
+
+namespace CConf {
+
+#pragma mark LatencyHistogram
+
+const int LatencyHistogram::BucketCount;
+
+/// bucket i holds samples in [2^(i-1), 2^i) ns, bucket 0 holds 0 ns
+static int BucketForNs(uint64_t ns) {
+  int bucket = 0;
+  while (ns) {
+    bucket++;
+    ns >>= 1;
+  }
+  return bucket < LatencyHistogram::BucketCount
+             ? bucket
+             : LatencyHistogram::BucketCount - 1;
+}
+
+void LatencyHistogram::record(uint64_t ns) {
+  _buckets[BucketForNs(ns)].fetch_add(1, memory_order_relaxed);
+  _count.fetch_add(1, memory_order_relaxed);
+  _totalNs.fetch_add(ns, memory_order_relaxed);
+
+  uint64_t prevMax = _maxNs.load(memory_order_relaxed);
+  while (ns > prevMax &&
+         !_maxNs.compare_exchange_weak(prevMax, ns, memory_order_relaxed)) {
+  }
+}
+
+uint64_t LatencyHistogram::percentileNs(double percent) const {
+  uint64_t n = count();
+  if (n == 0) return 0;
+
+  uint64_t target = (uint64_t)(n * percent / 100.0);
+  uint64_t seen = 0;
+  for (int i = 0; i < BucketCount; i++) {
+    seen += _buckets[i].load(memory_order_relaxed);
+    if (seen > target) return i == 0 ? 0 : min<uint64_t>(1ull << i, maxNs());
+  }
+  return maxNs();
+}
+
+void LatencyHistogram::reset() {
+  for (auto& bucket : _buckets) bucket.store(0, memory_order_relaxed);
+  _count.store(0, memory_order_relaxed);
+  _totalNs.store(0, memory_order_relaxed);
+  _maxNs.store(0, memory_order_relaxed);
+}
+
+#pragma mark ContextStats
+
+const uint64_t ContextStats::LookupSampleRate;
+
+const char* ContextStats::counterName(Counter counter) {
+  switch (counter) {
+    case FilesParsed:
+      return "files_parsed";
+    case ParseErrors:
+      return "parse_errors";
+    case NodesCreated:
+      return "nodes_created";
+    case NodesRemoved:
+      return "nodes_removed";
+    case TypeMismatches:
+      return "type_mismatches";
+    case Reloads:
+      return "reloads";
+    case Lookups:
+      return "lookups";
+    case CacheHits:
+      return "cache_hits";
+    case StartupCacheHits:
+      return "startup_cache_hits";
+    case StartupCacheMisses:
+      return "startup_cache_misses";
+    default:
+      return "unknown";
+  }
+}
+
+const char* ContextStats::histogramName(Histogram histogram) {
+  switch (histogram) {
+    case ParseTime:
+      return "parse";
+    case MergeTime:
+      return "merge";
+    case ReloadTime:
+      return "reload";
+    case RemoveTime:
+      return "remove";
+    case LookupTime:
+      return "lookup";
+    default:
+      return "unknown";
+  }
+}
+
+string ContextStats::toJson() const {
+  ostringstream out;
+  out << "{\"counters\": {";
+  for (int i = 0; i < CounterCount; i++) {
+    if (i) out << ", ";
+    out << "\"" << counterName((Counter)i) << "\": " << counter((Counter)i);
+  }
+  out << "}, \"latency_ns\": {";
+  for (int i = 0; i < HistogramCount; i++) {
+    const LatencyHistogram& h = histogram((Histogram)i);
+    if (i) out << ", ";
+    out << "\"" << histogramName((Histogram)i) << "\": {\"count\": "
+        << h.count() << ", \"mean\": " << (uint64_t)h.meanNs()
+        << ", \"p50\": " << h.percentileNs(50)
+        << ", \"p99\": " << h.percentileNs(99) << ", \"max\": " << h.maxNs()
+        << "}";
+  }
+  out << "}}";
+  return out.str();
+}
+
+void ContextStats::reset() {
+  for (auto& counter : _counters) counter.store(0, memory_order_relaxed);
+  for (auto& histogram : _histograms) histogram.reset();
+}
+
+};  //  end namespace CConf
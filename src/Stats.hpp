@@ -0,0 +1,140 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+namespace CConf {
+
+/// @brief Latency histogram with power-of-two nanosecond buckets
+///
+/// @details Recording is a handful of relaxed atomic operations, so it's
+/// cheap enough for hot paths and safe to call from any thread.  Percentiles
+/// are approximate: they report the upper bound of the bucket the percentile
+/// falls in.
+class LatencyHistogram {
+ public:
+  static const int BucketCount = 64;
+
+  LatencyHistogram() { reset(); }
+
+  void record(uint64_t ns);
+
+  uint64_t count() const { return _count.load(std::memory_order_relaxed); }
+  uint64_t totalNs() const { return _totalNs.load(std::memory_order_relaxed); }
+  uint64_t maxNs() const { return _maxNs.load(std::memory_order_relaxed); }
+  double meanNs() const {
+    uint64_t n = count();
+    return n ? (double)totalNs() / n : 0;
+  }
+
+  /// Approximate latency below which @p percent of the samples fall
+  uint64_t percentileNs(double percent) const;
+
+  void reset();
+
+  /// Records the time from construction to destruction into a histogram
+  class Timer {
+   public:
+    /// @histogram may be null, which makes the timer free: the clock is only
+    /// read when there is somewhere to record the time
+    explicit Timer(LatencyHistogram* histogram) : _histogram(histogram) {
+      if (_histogram) _start = std::chrono::steady_clock::now();
+    }
+    ~Timer() {
+      if (_histogram) {
+        _histogram->record(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                               std::chrono::steady_clock::now() - _start)
+                               .count());
+      }
+    }
+
+   private:
+    LatencyHistogram* _histogram;
+    std::chrono::steady_clock::time_point _start;
+  };
+
+ private:
+  std::atomic<uint64_t> _buckets[BucketCount];
+  std::atomic<uint64_t> _count;
+  std::atomic<uint64_t> _totalNs;
+  std::atomic<uint64_t> _maxNs;
+};
+
+/// @brief Counters and latency histograms for a Context
+///
+/// @details Always enabled.  Counters are relaxed atomics and lookups are
+/// only timed one in LookupSampleRate times, so the overhead stays in the
+/// noise.  Everything can be read from any thread while the Context keeps
+/// working.
+class ContextStats {
+ public:
+  enum Counter {
+    FilesParsed,
+    ParseErrors,
+    NodesCreated,
+    NodesRemoved,
+    TypeMismatches,
+    Reloads,
+    Lookups,
+    CacheHits,
+    StartupCacheHits,
+    StartupCacheMisses,
+    CounterCount
+  };
+
+  enum Histogram {
+    /// reading and parsing one file
+    ParseTime,
+    /// merging one parsed file onto the tree
+    MergeTime,
+    /// applying a reparsed file to the tree
+    ReloadTime,
+    /// removing one file's values from the tree
+    RemoveTime,
+    /// valueForKeyPath(), sampled
+    LookupTime,
+    HistogramCount
+  };
+
+  /// only every this many lookups is timed
+  static const uint64_t LookupSampleRate = 64;
+
+  ContextStats() { reset(); }
+
+  void increment(Counter counter, uint64_t amount = 1) {
+    _counters[counter].fetch_add(amount, std::memory_order_relaxed);
+  }
+  uint64_t counter(Counter counter) const {
+    return _counters[counter].load(std::memory_order_relaxed);
+  }
+
+  LatencyHistogram& histogram(Histogram histogram) {
+    return _histograms[histogram];
+  }
+  const LatencyHistogram& histogram(Histogram histogram) const {
+    return _histograms[histogram];
+  }
+
+  /// Counts a lookup and returns the histogram to time it into, or nullptr
+  /// if this one isn't sampled
+  LatencyHistogram* countLookup() {
+    uint64_t n = _counters[Lookups].fetch_add(1, std::memory_order_relaxed);
+    return n % LookupSampleRate == 0 ? &_histograms[LookupTime] : nullptr;
+  }
+
+  static const char* counterName(Counter counter);
+  static const char* histogramName(Histogram histogram);
+
+  /// All counters and histograms as a single line of json
+  std::string toJson() const;
+
+  void reset();
+
+ private:
+  std::atomic<uint64_t> _counters[CounterCount];
+  LatencyHistogram _histograms[HistogramCount];
+};
+
+};  //  end namespace CConf
@@ -0,0 +1,65 @@
+#include "Subscriptions.hpp"
+#include <utility>
+
+using namespace std;
+
+namespace CConf {
+
+SubscriptionId SubscriptionTrie::add(const string& keyPathPrefix,
+                                     const vector<string>& scope,
+                                     ChangeHandler handler) {
+  vector<string> segments;
+  if (!keyPathPrefix.empty()) {
+    size_t start = 0;
+    while (start <= keyPathPrefix.size()) {
+      size_t end = keyPathPrefix.find('.', start);
+      if (end == string::npos) end = keyPathPrefix.size();
+      segments.push_back(keyPathPrefix.substr(start, end - start));
+      start = end + 1;
+    }
+  }
+
+  TrieNode* node = &_root;
+  for (const string& segment : segments) {
+    unique_ptr<TrieNode>& child = node->children[segment];
+    if (!child) child.reset(new TrieNode());
+    node = child.get();
+  }
+
+  SubscriptionId id = _nextId++;
+  node->subscriptions.push_back(Subscription{id, scope, std::move(handler)});
+  _prefixes[id] = std::move(segments);
+  _count++;
+  return id;
+}
+
+bool SubscriptionTrie::remove(SubscriptionId id) {
+  auto itr = _prefixes.find(id);
+  if (itr == _prefixes.end()) return false;
+
+  //  remember the path so nodes left empty can be pruned on the way back up
+  vector<TrieNode*> path = {&_root};
+  for (const string& segment : itr->second) {
+    path.push_back(path.back()->children[segment].get());
+  }
+
+  vector<Subscription>& subs = path.back()->subscriptions;
+  for (size_t i = 0; i < subs.size(); i++) {
+    if (subs[i].id == id) {
+      subs.erase(subs.begin() + i);
+      break;
+    }
+  }
+
+  for (size_t i = itr->second.size(); i > 0; i--) {
+    TrieNode* node = path[i];
+    if (!node->subscriptions.empty() || !node->children.empty()) break;
+    path[i - 1]->children.erase(itr->second[i - 1]);
+  }
+
+  _prefixes.erase(itr);
+  _count--;
+  return true;
+}
+
+};  //  end namespace CConf
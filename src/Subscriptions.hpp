@@ -0,0 +1,89 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "Value.hpp"
+
+namespace CConf {
+
+/// A change to the resolved value of one key path
+struct ValueChange {
+  std::string keyPath;
+  /// the value before and after, resolved under the subscription's scope.
+  /// nullptr if there was none.  Only valid during the handler call.
+  const Value* oldValue;
+  const Value* newValue;
+};
+
+/// Receives every change that matched a subscription in one batch
+typedef std::function<void(const std::vector<ValueChange>& changes)>
+    ChangeHandler;
+
+typedef uint64_t SubscriptionId;
+static const SubscriptionId InvalidSubscriptionId = 0;
+
+/// @brief Change subscriptions, stored in a trie by key path prefix
+///
+/// @details Finding the subscriptions interested in a key path walks one
+/// trie node per segment of the key path, so the cost depends on the key
+/// path and the number of matching subscriptions, not on how many there are
+/// in total.
+class SubscriptionTrie {
+ public:
+  struct Subscription {
+    SubscriptionId id;
+    std::vector<std::string> scope;
+    ChangeHandler handler;
+  };
+
+  SubscriptionTrie() : _nextId(1), _count(0) {}
+
+  /// @param keyPathPrefix dot-separated key path; matches itself and
+  /// everything below it.  An empty prefix matches every key path.
+  SubscriptionId add(const std::string& keyPathPrefix,
+                     const std::vector<std::string>& scope,
+                     ChangeHandler handler);
+
+  /// @return whether there was such a subscription
+  bool remove(SubscriptionId id);
+
+  bool contains(SubscriptionId id) const { return _prefixes.count(id) > 0; }
+  bool empty() const { return _count == 0; }
+  size_t size() const { return _count; }
+
+  /// Calls @visitor with every subscription whose prefix covers @keyPath
+  template <typename Visitor>
+  void forEachMatch(const std::string& keyPath, Visitor visitor) const {
+    const TrieNode* node = &_root;
+    size_t start = 0;
+    while (true) {
+      for (const Subscription& sub : node->subscriptions) visitor(sub);
+      if (start > keyPath.size()) return;
+
+      size_t end = keyPath.find('.', start);
+      if (end == std::string::npos) end = keyPath.size();
+      auto child = node->children.find(keyPath.substr(start, end - start));
+      if (child == node->children.end()) return;
+      node = child->second.get();
+      start = end + 1;
+    }
+  }
+
+ private:
+  struct TrieNode {
+    std::vector<Subscription> subscriptions;
+    std::unordered_map<std::string, std::unique_ptr<TrieNode>> children;
+  };
+
+  TrieNode _root;
+  /// the prefix segments of each subscription, to find it again on removal
+  std::unordered_map<SubscriptionId, std::vector<std::string>> _prefixes;
+  SubscriptionId _nextId;
+  size_t _count;
+};
+
+};  //  end namespace CConf
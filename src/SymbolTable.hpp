@@ -0,0 +1,86 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include "KeyPath.hpp"
+
+namespace CConf {
+
+/// Small integer id for an interned string.  See SymbolTable.
+typedef uint32_t Symbol;
+
+const Symbol InvalidSymbol = UINT32_MAX;
+
+/// @brief Interns strings as small integer ids
+///
+/// @details Keys, scope names and file paths repeat all over the config tree
+/// (every robot shares the same scope names and key names).  Each distinct
+/// string is stored once here and everything else refers to it by Symbol, so
+/// comparing and hashing them is an integer operation.
+///
+/// Symbols are never released - a table only grows for the lifetime of its
+/// Context.
+class SymbolTable {
+ public:
+  /// Returns the symbol for @str, adding it to the table if necessary
+  Symbol intern(const std::string& str) {
+    auto result = _symbols.insert(std::make_pair(str, (Symbol)_strings.size()));
+    if (result.second) {
+      _strings.push_back(&result.first->first);
+      _symbolsByHash.insert(std::make_pair(
+          HashString(str.data(), str.size()), result.first->second));
+    }
+    return result.first->second;
+  }
+
+  /// @brief Find a symbol by a precomputed HashString() of its string
+  /// @details Doesn't hash or copy @str - it's only compared against the
+  /// candidates with a matching hash.
+  /// @return the symbol or InvalidSymbol if it was never interned
+  Symbol find(uint64_t hash, const char* str, size_t len) const {
+    auto range = _symbolsByHash.equal_range(hash);
+    for (auto itr = range.first; itr != range.second; ++itr) {
+      const std::string& candidate = *_strings[itr->second];
+      if (candidate.size() == len && candidate.compare(0, len, str, len) == 0)
+        return itr->second;
+    }
+    return InvalidSymbol;
+  }
+
+  /// Returns the symbol for @str or InvalidSymbol if it was never interned
+  Symbol find(const std::string& str) const {
+    auto itr = _symbols.find(str);
+    return itr != _symbols.end() ? itr->second : InvalidSymbol;
+  }
+
+  /// Looks up each string of @strs, stopping at the first one that was never
+  /// interned.  Useful for scopes: nothing can be defined below a scope name
+  /// that doesn't exist.
+  void findAll(const std::vector<std::string>& strs,
+               std::vector<Symbol>* symbolsOut) const {
+    for (const std::string& str : strs) {
+      Symbol sym = find(str);
+      if (sym == InvalidSymbol) break;
+      symbolsOut->push_back(sym);
+    }
+  }
+
+  const std::string& str(Symbol sym) const { return *_strings[sym]; }
+
+  size_t size() const { return _strings.size(); }
+
+ private:
+  std::unordered_map<std::string, Symbol> _symbols;
+  /// points at the keys of _symbols, which never move
+  std::vector<const std::string*> _strings;
+
+  struct IdentityHash {
+    size_t operator()(uint64_t hash) const { return (size_t)hash; }
+  };
+  /// the same symbols again, keyed by their HashString()
+  std::unordered_multimap<uint64_t, Symbol, IdentityHash> _symbolsByHash;
+};
+
+};  //  end namespace CConf
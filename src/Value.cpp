@@ -0,0 +1,277 @@
+#include "Value.hpp"
+#include <cstring>
+#include <utility>
+
+using namespace std;
+
+namespace CConf {
+
+const size_t Value::SmallStringCapacity;
+
+static_assert(sizeof(Value) == 16, "Value should stay as small as QVariant");
+
+/// Whether converting @value to a double and back gives the same number
+static bool IsExactDouble(const Value& value) {
+  const int64_t limit = 1ll << 53;
+  switch (value.type()) {
+    case Value::Int:
+      return value.toInt() >= -limit && value.toInt() <= limit;
+    case Value::UInt:
+      return (uint64_t)value.toInt() <= (uint64_t)limit;
+    default:
+      return true;
+  }
+}
+
+Value::Value(vector<Value> list) : _type(List), _smallLength(0) {
+  Payload* payload = new Payload();
+  payload->refs.store(1, memory_order_relaxed);
+
+  bool numbers = !list.empty();
+  bool ints = numbers;
+  bool exact = true;
+  bool sameType = true;
+  for (const Value& element : list) {
+    numbers = numbers && element.isNumber();
+    ints = ints && element.type() == Int && element.toInt() >= INT32_MIN &&
+           element.toInt() <= INT32_MAX;
+    exact = exact && IsExactDouble(element);
+    sameType = sameType && element.type() == list.front().type();
+  }
+
+  if (numbers) {
+    payload->doubles.reserve(list.size());
+    for (const Value& element : list) {
+      payload->doubles.push_back(element.toDouble());
+    }
+    if (ints) {
+      payload->ints.reserve(list.size());
+      for (const Value& element : list) {
+        payload->ints.push_back((int)element.toInt());
+      }
+    }
+    if (!exact) {
+      payload->integers.reserve(list.size());
+      for (const Value& element : list) {
+        payload->integers.push_back(element.toInt());
+      }
+    }
+    if (sameType) {
+      payload->types.push_back(list.front().type());
+    } else {
+      payload->types.reserve(list.size());
+      for (const Value& element : list) {
+        payload->types.push_back(element.type());
+      }
+    }
+  } else {
+    payload->list = std::move(list);
+  }
+  _store(payload);
+}
+
+Value::Value(const Value& other)
+    : _type(other._type), _smallLength(other._smallLength) {
+  memcpy(_data, other._data, sizeof(_data));
+  if (_isShared()) _payload()->refs.fetch_add(1, memory_order_relaxed);
+}
+
+Value::Value(Value&& other)
+    : _type(other._type), _smallLength(other._smallLength) {
+  memcpy(_data, other._data, sizeof(_data));
+  other._type = Null;
+  other._smallLength = 0;
+}
+
+Value& Value::operator=(Value other) {
+  //  other is a copy, so swapping hands it the old contents to release
+  char data[SmallStringCapacity];
+  memcpy(data, _data, sizeof(data));
+  memcpy(_data, other._data, sizeof(data));
+  memcpy(other._data, data, sizeof(data));
+  std::swap(_type, other._type);
+  std::swap(_smallLength, other._smallLength);
+  return *this;
+}
+
+void Value::_setString(const char* str, size_t length) {
+  _type = String;
+  if (length <= SmallStringCapacity) {
+    _smallLength = length;
+    memcpy(_data, str, length);
+  } else {
+    _smallLength = SmallStringCapacity + 1;
+    Payload* payload = new Payload();
+    payload->refs.store(1, memory_order_relaxed);
+    payload->str.assign(str, length);
+    _store(payload);
+  }
+}
+
+void Value::_release() {
+  if (_isShared() &&
+      _payload()->refs.fetch_sub(1, memory_order_acq_rel) == 1) {
+    delete _payload();
+  }
+}
+
+bool Value::toBool() const {
+  switch (_type) {
+    case Bool:
+      return _load<uint64_t>() != 0;
+    case Int:
+    case UInt:
+      return _load<uint64_t>() != 0;
+    case Double:
+      return _load<double>() != 0;
+    default:
+      return false;
+  }
+}
+
+int64_t Value::toInt() const {
+  switch (_type) {
+    case Bool:
+      return _load<uint64_t>() != 0;
+    case Int:
+    case UInt:
+      return _load<int64_t>();
+    case Double:
+      return (int64_t)_load<double>();
+    default:
+      return 0;
+  }
+}
+
+double Value::toDouble() const {
+  switch (_type) {
+    case Bool:
+      return _load<uint64_t>() != 0;
+    case Int:
+      return (double)_load<int64_t>();
+    case UInt:
+      return (double)_load<uint64_t>();
+    case Double:
+      return _load<double>();
+    default:
+      return 0;
+  }
+}
+
+const char* Value::stringData() const {
+  if (_type != String) return "";
+  return _smallLength <= SmallStringCapacity ? _data : _payload()->str.data();
+}
+
+size_t Value::stringLength() const {
+  if (_type != String) return 0;
+  return _smallLength <= SmallStringCapacity ? _smallLength
+                                             : _payload()->str.size();
+}
+
+size_t Value::listSize() const {
+  if (_type != List) return 0;
+  const Payload* payload = _payload();
+  return payload->list.empty() ? payload->doubles.size() : payload->list.size();
+}
+
+Value Value::listAt(size_t i) const {
+  if (_type != List) return Value();
+  const Payload* payload = _payload();
+  if (!payload->list.empty()) return payload->list[i];
+  if (!payload->ints.empty()) return Value(payload->ints[i]);
+
+  Type type = payload->types.size() == 1 ? payload->types[0]
+                                          : payload->types[i];
+  if (type == Double) return Value(payload->doubles[i]);
+  int64_t exact = payload->integers.empty() ? (int64_t)payload->doubles[i]
+                                            : payload->integers[i];
+  return type == Int ? Value(exact) : Value((uint64_t)exact);
+}
+
+bool Value::isNumberList() const {
+  return _type == List && !_payload()->doubles.empty();
+}
+
+Span<double> Value::doubles() const {
+  if (_type != List) return Span<double>();
+  const Payload* payload = _payload();
+  return Span<double>(payload->doubles.data(), payload->doubles.size());
+}
+
+Span<int> Value::ints() const {
+  if (_type != List) return Span<int>();
+  const Payload* payload = _payload();
+  return Span<int>(payload->ints.data(), payload->ints.size());
+}
+
+bool Value::operator==(const Value& other) const {
+  if (_type != other._type) return false;
+  switch (_type) {
+    case Null:
+      return true;
+    case Bool:
+    case Int:
+    case UInt:
+      return _load<uint64_t>() == other._load<uint64_t>();
+    case Double:
+      return _load<double>() == other._load<double>();
+    case String:
+      return stringLength() == other.stringLength() &&
+             memcmp(stringData(), other.stringData(), stringLength()) == 0;
+    case List:
+      if (_payload() == other._payload()) return true;
+      if (listSize() != other.listSize()) return false;
+      for (size_t i = 0; i < listSize(); i++) {
+        if (listAt(i) != other.listAt(i)) return false;
+      }
+      return true;
+    default:
+      return false;
+  }
+}
+
+QVariant Value::toVariant() const {
+  switch (_type) {
+    case Bool:
+      return QVariant(toBool());
+    case Int: {
+      int64_t i = _load<int64_t>();
+      if (i >= INT32_MIN && i <= INT32_MAX) return QVariant((int)i);
+      return QVariant((long long)i);
+    }
+    case UInt: {
+      uint64_t u = _load<uint64_t>();
+      if (u <= UINT32_MAX) return QVariant((unsigned)u);
+      return QVariant((unsigned long long)u);
+    }
+    case Double:
+      return QVariant(_load<double>());
+    case String:
+      return QVariant(QString::fromStdString(toString()));
+    case List: {
+      QList<QVariant> lst;
+      for (size_t i = 0; i < listSize(); i++) {
+        lst.append(listAt(i).toVariant());
+      }
+      return QVariant(lst);
+    }
+    default:
+      return QVariant();
+  }
+}
+
+size_t Value::bytesUsed() const {
+  if (!_isShared()) return 0;
+  const Payload* payload = _payload();
+  size_t bytes = sizeof(Payload) + payload->str.capacity() +
+                 payload->list.capacity() * sizeof(Value) +
+                 payload->doubles.capacity() * sizeof(double) +
+                 payload->ints.capacity() * sizeof(int) +
+                 payload->integers.capacity() * sizeof(int64_t) +
+                 payload->types.capacity() * sizeof(Type);
+  for (const Value& element : payload->list) bytes += element.bytesUsed();
+  return bytes;
+}
+
+};  //  end namespace CConf
@@ -0,0 +1,175 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <QVariant>
+#include "Span.hpp"
+
+namespace CConf {
+
+/// @brief A single config value: null, bool, integer, double, string or list
+///
+/// @details This is what the tree stores for every leaf instead of a
+/// QVariant.  Scalars are stored inline and so are strings of up to
+/// SmallStringCapacity bytes.  Longer strings and lists live in an immutable,
+/// reference-counted payload that copies share, so copying a Value never
+/// allocates.  Strings are kept as the UTF-8 bytes from the file.
+///
+/// Lists whose elements are all numbers are packed into a contiguous,
+/// cache-line aligned array of doubles (and of ints, if every element is an
+/// Int that fits in one) that can be viewed with doubles() and ints() without
+/// copying.  listAt() returns each element with its original type and value:
+/// lists with integers beyond 2^53, which a double can't hold exactly, also
+/// keep every element as an int64_t.
+///
+/// Use toVariant() where a QVariant is needed (the Qt model); everything else
+/// should read the value directly.
+class Value {
+ public:
+  enum Type : uint8_t { Null, Bool, Int, UInt, Double, String, List };
+
+  static const size_t SmallStringCapacity = 14;
+
+  Value() : _type(Null), _smallLength(0) {}
+  explicit Value(bool b) : _type(Bool), _smallLength(0) { _store<uint64_t>(b); }
+  explicit Value(int i) : _type(Int), _smallLength(0) { _store<int64_t>(i); }
+  explicit Value(int64_t i) : _type(Int), _smallLength(0) { _store(i); }
+  explicit Value(unsigned u) : _type(UInt), _smallLength(0) {
+    _store<uint64_t>(u);
+  }
+  explicit Value(uint64_t u) : _type(UInt), _smallLength(0) { _store(u); }
+  explicit Value(double d) : _type(Double), _smallLength(0) { _store(d); }
+  explicit Value(const std::string& str) { _setString(str.data(), str.size()); }
+  Value(const char* str, size_t length) { _setString(str, length); }
+  explicit Value(std::vector<Value> list);
+
+  Value(const Value& other);
+  Value(Value&& other);
+  Value& operator=(Value other);
+  ~Value() { _release(); }
+
+  Type type() const { return (Type)_type; }
+  bool isNull() const { return _type == Null; }
+  bool isNumber() const {
+    return _type == Int || _type == UInt || _type == Double;
+  }
+
+  /// Numeric conversions.  Other types convert to 0 (or false).
+  bool toBool() const;
+  int64_t toInt() const;
+  double toDouble() const;
+
+  /// The string bytes, not null-terminated.  Empty for non-strings.
+  const char* stringData() const;
+  size_t stringLength() const;
+  std::string toString() const {
+    return std::string(stringData(), stringLength());
+  }
+
+  /// The list elements.  Empty for non-lists.
+  size_t listSize() const;
+  Value listAt(size_t i) const;
+
+  /// Whether this is a non-empty list of numbers, stored packed
+  bool isNumberList() const;
+
+  /// The elements of a number list, converted to double like toDouble().
+  /// Empty for anything else.
+  Span<double> doubles() const;
+
+  /// The elements of a list of Ints.  Empty for anything else, including
+  /// lists with any non-integer element.
+  Span<int> ints() const;
+
+  bool operator==(const Value& other) const;
+  bool operator!=(const Value& other) const { return !(*this == other); }
+
+  /// Converts to the QVariant the Qt model shows.  Allocates for strings and
+  /// lists.
+  QVariant toVariant() const;
+
+  /// Heap memory held by this value beyond sizeof(Value), ignoring sharing
+  size_t bytesUsed() const;
+
+ private:
+  struct Payload {
+    std::atomic<uint32_t> refs;
+    std::string str;
+    /// generic lists only
+    std::vector<Value> list;
+    /// number lists only.  ints is empty unless every element was an Int
+    /// that fits in an int, integers unless an element was an integer that
+    /// doesn't fit in a double exactly.
+    AlignedVector<double> doubles;
+    AlignedVector<int> ints;
+    AlignedVector<int64_t> integers;
+    /// the type of every element, or a single one if they all have it
+    std::vector<Type> types;
+  };
+
+  /// Scalars and the payload pointer are copied in and out of _data, which
+  /// keeps the whole value at 16 bytes
+  template <typename T>
+  void _store(T value) {
+    std::memcpy(_data, &value, sizeof(T));
+  }
+  template <typename T>
+  T _load() const {
+    T value;
+    std::memcpy(&value, _data, sizeof(T));
+    return value;
+  }
+  Payload* _payload() const { return _load<Payload*>(); }
+
+  void _setString(const char* str, size_t length);
+  bool _isShared() const {
+    return (_type == String && _smallLength > SmallStringCapacity) ||
+           _type == List;
+  }
+  void _release();
+
+  /// scalar, payload pointer or inline string
+  alignas(8) char _data[SmallStringCapacity];
+  uint8_t _type;
+  /// length of an inline string, or SmallStringCapacity + 1 for a shared one
+  uint8_t _smallLength;
+};
+
+/// Converts a config value to a C++ type.  See ConfigValue.
+template <typename T>
+T ValueAs(const Value& value);
+
+template <>
+inline double ValueAs<double>(const Value& value) {
+  return value.toDouble();
+}
+
+template <>
+inline std::string ValueAs<std::string>(const Value& value) {
+  return value.toString();
+}
+
+template <>
+inline Value ValueAs<Value>(const Value& value) {
+  return value;
+}
+
+/// A number list as a span of T (double or int).  See Value::doubles().
+template <typename T>
+Span<T> ValueSpan(const Value& value);
+
+template <>
+inline Span<double> ValueSpan<double>(const Value& value) {
+  return value.doubles();
+}
+
+template <>
+inline Span<int> ValueSpan<int>(const Value& value) {
+  return value.ints();
+}
+
+};  //  end namespace CConf
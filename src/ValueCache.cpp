@@ -0,0 +1,104 @@
+#include "ValueCache.hpp"
+#include "ConfigContext.hpp"
+
+using namespace std;
+
+namespace CConf {
+
+uint64_t ValueCache::Hash(uint64_t keyPathHash, const vector<string>& scope) {
+  uint64_t h = keyPathHash;
+  for (const string& s : scope) {
+    h ^= HashString(s.data(), s.size()) + 0x9e3779b9 + (h << 6) + (h >> 2);
+  }
+  return h;
+}
+
+unordered_multimap<uint64_t, ValueCache::Entry,
+                   ValueCache::IdentityHash>::iterator
+ValueCache::_find(uint64_t hash, const char* keyPath, size_t len,
+                  const vector<string>& scope) {
+  auto range = _entries.equal_range(hash);
+  for (auto itr = range.first; itr != range.second; ++itr) {
+    const Entry& entry = itr->second;
+    if (entry.keyPath.compare(0, string::npos, keyPath, len) == 0 &&
+        entry.scope == scope) {
+      return itr;
+    }
+  }
+  return _entries.end();
+}
+
+bool ValueCache::find(uint64_t hash, const char* keyPath, size_t len,
+                      const vector<string>& scope,
+                      uint64_t structureGeneration, const Value** valueOut) {
+  auto itr = _find(hash, keyPath, len, scope);
+  if (itr != _entries.end()) {
+    const Entry& entry = itr->second;
+    uint64_t currentGeneration =
+        entry.node ? entry.node->generation() : structureGeneration;
+    if (entry.generation == currentGeneration) {
+      _hits++;
+      *valueOut = entry.value;
+      return true;
+    }
+  }
+
+  _misses++;
+  return false;
+}
+
+void ValueCache::insert(uint64_t hash, const char* keyPath, size_t len,
+                        const vector<string>& scope, const ValueNode* node,
+                        const Value* value, uint64_t structureGeneration) {
+  uint64_t generation = node ? node->generation() : structureGeneration;
+
+  auto itr = _find(hash, keyPath, len, scope);
+  if (itr != _entries.end()) {
+    //  a stale entry for this key - only touch the reverse index if the entry
+    //  moved to a different node
+    Entry& entry = itr->second;
+    const ValueNode* oldNode = entry.node;
+    entry.node = node;
+    entry.generation = generation;
+    entry.value = value;
+    if (oldNode == node) return;
+    if (oldNode) {
+      vector<uint64_t>& keys = _keysByNode[oldNode];
+      for (size_t i = 0; i < keys.size(); i++) {
+        if (keys[i] == hash) {
+          keys.erase(keys.begin() + i);
+          break;
+        }
+      }
+    }
+  } else {
+    Entry entry{string(keyPath, len), scope, node, generation, value};
+    _entries.insert(make_pair(hash, std::move(entry)));
+  }
+
+  if (node) _keysByNode[node].push_back(hash);
+}
+
+void ValueCache::invalidateNode(const ValueNode* node) {
+  auto itr = _keysByNode.find(node);
+  if (itr == _keysByNode.end()) return;
+
+  for (uint64_t hash : itr->second) {
+    auto range = _entries.equal_range(hash);
+    for (auto entry = range.first; entry != range.second;) {
+      if (entry->second.node == node) {
+        entry = _entries.erase(entry);
+      } else {
+        ++entry;
+      }
+    }
+  }
+  _keysByNode.erase(itr);
+}
+
+void ValueCache::clear() {
+  _entries.clear();
+  _keysByNode.clear();
+}
+
+};  //  end namespace CConf
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include "KeyPath.hpp"
+#include "Value.hpp"
+
+namespace CConf {
+
+class ValueNode;
+
+/// @brief Cache of resolved values, keyed by key path and scope.
+///
+/// @details Each entry remembers the leaf it was resolved from and that leaf's
+/// generation at the time.  An entry is only served if the leaf hasn't changed
+/// since, so mutating one leaf implicitly invalidates just the entries that
+/// resolved through it.  Lookups for key paths that don't exist are cached too
+/// and are checked against the structure generation of the tree, which changes
+/// whenever a node is added.
+///
+/// Entries are keyed by a hash of the key path and scope (see Hash()) that
+/// starts from the key path's HashString().  A KeyPath has that precomputed,
+/// so a hit never hashes the key path and neither kind of lookup allocates.
+///
+/// Entries that point at a node must be dropped with invalidateNode() before
+/// that node is deleted.
+class ValueCache {
+ public:
+  ValueCache() : _hits(0), _misses(0) {}
+
+  /// The key for a lookup of a key path with the given HashString() under
+  /// @scope
+  static uint64_t Hash(uint64_t keyPathHash,
+                       const std::vector<std::string>& scope);
+
+  /// @brief Find a still-valid entry for a key path and scope
+  ///
+  /// @param hash Hash() of the key path and scope
+  /// @param keyPath the key path, @len characters long
+  /// @param scope the scope being looked up
+  /// @param structureGeneration the current structure generation of the tree
+  /// @param valueOut set to the cached value (possibly nullptr) on a hit
+  /// @return true if the cache had a valid entry
+  bool find(uint64_t hash, const char* keyPath, size_t len,
+            const std::vector<std::string>& scope,
+            uint64_t structureGeneration, const Value** valueOut);
+
+  /// Record the result of resolving a key path under @scope.  @node is the
+  /// leaf at the key path, or nullptr if there isn't one.
+  void insert(uint64_t hash, const char* keyPath, size_t len,
+              const std::vector<std::string>& scope, const ValueNode* node,
+              const Value* value, uint64_t structureGeneration);
+
+  /// Drop all entries that were resolved through @node
+  void invalidateNode(const ValueNode* node);
+
+  void clear();
+
+  size_t size() const { return _entries.size(); }
+  uint64_t hits() const { return _hits; }
+  uint64_t misses() const { return _misses; }
+
+ private:
+  struct Entry {
+    std::string keyPath;
+    std::vector<std::string> scope;
+    const ValueNode* node;
+    /// the node's generation or, for missing key paths, the structure
+    /// generation of the tree when the entry was made
+    uint64_t generation;
+    const Value* value;
+  };
+
+  /// the keys are already hashes
+  struct IdentityHash {
+    size_t operator()(uint64_t hash) const { return (size_t)hash; }
+  };
+
+  /// the entry for the key path and scope under @hash, or _entries.end()
+  std::unordered_multimap<uint64_t, Entry, IdentityHash>::iterator _find(
+      uint64_t hash, const char* keyPath, size_t len,
+      const std::vector<std::string>& scope);
+
+  std::unordered_multimap<uint64_t, Entry, IdentityHash> _entries;
+
+  /// reverse index so a node's entries can be dropped without a full scan
+  std::unordered_map<const ValueNode*, std::vector<uint64_t>> _keysByNode;
+
+  uint64_t _hits;
+  uint64_t _misses;
+};
+
+};  //  end namespace CConf
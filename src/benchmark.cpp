@@ -0,0 +1,366 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <json/json.h>
+#include <unistd.h>
+
+#include <QCoreApplication>
+
+#include "ConfigContext.hpp"
+
+using namespace std;
+
+//  Benchmark suite for Context.  Generates a synthetic set of cascaded config
+//  files and times loading, merging, lookups, removal, reloading and model
+//  traversal over them.  Results are printed as json (default) or csv so they
+//  can be compared across releases.
+//
+//  usage: cconf-bench [--keys N] [--depth N] [--fanout N] [--scope-depth N]
+//                     [--files N] [--rounds N] [--format json|csv]
+
+struct BenchParams {
+  /// number of distinct key paths
+  int keys = 1000;
+  /// segments per key path, including the leaf key
+  int depth = 3;
+  /// sibling scopes per level of $$ nesting
+  int fanout = 4;
+  /// levels of $$ nesting
+  int scopeDepth = 2;
+  /// number of cascaded files.  The first defines every key without a
+  /// scope, the others split the keys between them and override them under
+  /// every scope.
+  int files = 4;
+  /// repetitions for the lookup, removal and reload measurements
+  int rounds = 50;
+  string format = "json";
+};
+
+struct BenchResult {
+  string name;
+  long long iterations;
+  double totalMs;
+};
+
+#pragma mark Generator
+
+static string keyPathForKey(const BenchParams& params, int k) {
+  string keyPath;
+  for (int level = params.depth - 2; level >= 0; level--) {
+    keyPath += "g" + to_string((k >> (3 * level)) % 8) + ".";
+  }
+  return keyPath + "key" + to_string(k);
+}
+
+static Json::Value& nodeForKeyPath(Json::Value& root, const string& keyPath) {
+  Json::Value* node = &root;
+  size_t start = 0;
+  while (true) {
+    size_t end = keyPath.find('.', start);
+    if (end == string::npos) return (*node)[keyPath.substr(start)];
+    node = &(*node)[keyPath.substr(start, end - start)];
+    start = end + 1;
+  }
+}
+
+/// Adds a value for @keyPath under every scope below @scope, @levels deep
+static void addScopedValues(const BenchParams& params, Json::Value& scope,
+                            const string& keyPath, int value, int levels,
+                            int* valueCount) {
+  if (levels == 0) return;
+  for (int i = 0; i < params.fanout; i++) {
+    Json::Value& subscope = scope[CConf::CConfScopeKeyPrefix + "s" +
+                                  to_string(params.scopeDepth - levels) + "_" +
+                                  to_string(i)];
+    nodeForKeyPath(subscope, keyPath) = value + i;
+    (*valueCount)++;
+    addScopedValues(params, subscope, keyPath, value + i, levels - 1,
+                    valueCount);
+  }
+}
+
+/// Builds the json for file @f.  @salt changes every value, for reloads.
+static Json::Value generateFile(const BenchParams& params, int f, int salt,
+                                int* valueCount) {
+  Json::Value root(Json::objectValue);
+  for (int k = 0; k < params.keys; k++) {
+    string keyPath = keyPathForKey(params, k);
+    if (f == 0) {
+      nodeForKeyPath(root, keyPath) = k + salt;
+      (*valueCount)++;
+    } else if (k % (params.files - 1) == f - 1) {
+      addScopedValues(params, root, keyPath, k + salt, params.scopeDepth,
+                      valueCount);
+    }
+  }
+  return root;
+}
+
+static void writeJson(const string& path, const Json::Value& json) {
+  ofstream out(path);
+  Json::StyledStreamWriter writer;
+  writer.write(out, json);
+}
+
+/// @brief A fresh directory under $TMPDIR (or /tmp) for the generated files
+/// @details Removes the files it handed out paths for, and itself, when it
+/// goes away, so nothing is left behind in the working directory or in /tmp.
+class TempDir {
+ public:
+  TempDir() {
+    const char* tmp = getenv("TMPDIR");
+    string pattern = string(tmp && *tmp ? tmp : "/tmp") + "/cconf-bench-XXXXXX";
+    vector<char> buffer(pattern.begin(), pattern.end());
+    buffer.push_back('\0');
+    if (!mkdtemp(buffer.data())) {
+      throw runtime_error("unable to create a directory in '" + pattern + "'");
+    }
+    _path = buffer.data();
+  }
+
+  ~TempDir() {
+    for (const string& file : _files) remove(file.c_str());
+    rmdir(_path.c_str());
+  }
+
+  /// path for a file named @name in the directory
+  string file(const string& name) {
+    _files.push_back(_path + "/" + name);
+    return _files.back();
+  }
+
+ private:
+  string _path;
+  vector<string> _files;
+};
+
+/// The scope path that picks scope @i at every level
+static vector<string> scopeForIndex(const BenchParams& params, int i) {
+  vector<string> scope;
+  for (int level = 0; level < params.scopeDepth; level++) {
+    scope.push_back("s" + to_string(level) + "_" +
+                    to_string((i + level) % params.fanout));
+  }
+  return scope;
+}
+
+#pragma mark Measurements
+
+static double elapsedMs(chrono::steady_clock::time_point start) {
+  return chrono::duration<double, milli>(chrono::steady_clock::now() - start)
+      .count();
+}
+
+static BenchResult timeIt(const string& name, long long iterations,
+                          const function<void()>& body) {
+  auto start = chrono::steady_clock::now();
+  body();
+  return BenchResult{name, iterations, elapsedMs(start)};
+}
+
+/// Visits every row of @model, fetching lazily populated branches first
+static long long traverseModel(QAbstractItemModel* model,
+                               const QModelIndex& parent) {
+  while (model->canFetchMore(parent)) model->fetchMore(parent);
+
+  long long visited = 0;
+  int rows = model->rowCount(parent);
+  for (int row = 0; row < rows; row++) {
+    QModelIndex key = model->index(row, 0, parent);
+    model->data(key);
+    model->data(model->index(row, 1, parent));
+    model->parent(key);
+    visited += 1 + traverseModel(model, key);
+  }
+  return visited;
+}
+
+static void printResults(const BenchParams& params,
+                         const vector<BenchResult>& results) {
+  if (params.format == "csv") {
+    printf("name,iterations,total_ms,ns_per_op\n");
+    for (const BenchResult& r : results) {
+      printf("%s,%lld,%.3f,%.1f\n", r.name.c_str(), r.iterations, r.totalMs,
+             r.totalMs * 1e6 / r.iterations);
+    }
+    return;
+  }
+
+  Json::Value out(Json::objectValue);
+  out["params"]["keys"] = params.keys;
+  out["params"]["depth"] = params.depth;
+  out["params"]["fanout"] = params.fanout;
+  out["params"]["scope_depth"] = params.scopeDepth;
+  out["params"]["files"] = params.files;
+  out["params"]["rounds"] = params.rounds;
+  for (const BenchResult& r : results) {
+    Json::Value entry(Json::objectValue);
+    entry["name"] = r.name;
+    entry["iterations"] = (Json::Int64)r.iterations;
+    entry["total_ms"] = r.totalMs;
+    entry["ns_per_op"] = r.totalMs * 1e6 / r.iterations;
+    out["results"].append(entry);
+  }
+  Json::StyledStreamWriter writer;
+  writer.write(cout, out);
+}
+
+static bool parseArgs(int argc, char** argv, BenchParams* params) {
+  for (int i = 1; i < argc; i++) {
+    string arg = argv[i];
+    if (i + 1 >= argc) return false;
+    string value = argv[++i];
+    if (arg == "--keys") {
+      params->keys = atoi(value.c_str());
+    } else if (arg == "--depth") {
+      params->depth = atoi(value.c_str());
+    } else if (arg == "--fanout") {
+      params->fanout = atoi(value.c_str());
+    } else if (arg == "--scope-depth") {
+      params->scopeDepth = atoi(value.c_str());
+    } else if (arg == "--files") {
+      params->files = atoi(value.c_str());
+    } else if (arg == "--rounds") {
+      params->rounds = atoi(value.c_str());
+    } else if (arg == "--format") {
+      params->format = value;
+    } else {
+      return false;
+    }
+  }
+  return params->keys > 0 && params->depth > 0 && params->fanout > 0 &&
+         params->scopeDepth >= 0 && params->files > 1 && params->rounds > 0 &&
+         (params->format == "json" || params->format == "csv");
+}
+
+int main(int argc, char** argv) {
+  BenchParams params;
+  if (!parseArgs(argc, argv, &params)) {
+    cerr << "usage: " << argv[0]
+         << " [--keys N] [--depth N] [--fanout N] [--scope-depth N]"
+            " [--files N (>= 2)] [--rounds N] [--format json|csv]"
+         << endl;
+    return 1;
+  }
+
+  QCoreApplication app(argc, argv);
+  vector<BenchResult> results;
+
+  //  generate the files.  The directory outlives the context, which watches
+  //  them.
+  TempDir dir;
+  vector<string> paths;
+  int valueCount = 0;
+  for (int f = 0; f < params.files; f++) {
+    paths.push_back(dir.file("cconf-bench-" + to_string(f) + ".json"));
+    writeJson(paths.back(), generateFile(params, f, 0, &valueCount));
+  }
+  int lastValueCount = 0;
+  Json::Value lastFile = generateFile(params, params.files - 1, 0,
+                                      &lastValueCount);
+  Json::Value lastFileChanged = generateFile(params, params.files - 1, 1,
+                                             &lastValueCount);
+
+  //  parsing alone, so merging can be told apart from it
+  BenchResult parse = timeIt("parse", valueCount, [&]() {
+    for (const string& path : paths) CConf::Context::readFileTree(path);
+  });
+  results.push_back(parse);
+
+  auto ctxt = make_shared<CConf::Context>();
+  BenchResult load = timeIt("load", valueCount, [&]() {
+    for (const string& path : paths) ctxt->addFile(path);
+  });
+  results.push_back(load);
+  results.push_back(BenchResult{"merge", valueCount,
+                                max(load.totalMs - parse.totalMs, 0.0)});
+
+  results.push_back(timeIt("load_parallel", valueCount, [&]() {
+    CConf::Context batch;
+    batch.addFiles(paths);
+  }));
+
+  //  lookups
+  vector<string> keyPaths;
+  for (int k = 0; k < params.keys; k++) {
+    keyPaths.push_back(keyPathForKey(params, k));
+  }
+  vector<vector<string>> scopes;
+  for (int i = 0; i < params.fanout; i++) {
+    scopes.push_back(scopeForIndex(params, i));
+  }
+  scopes.push_back({});
+
+  long long lookups = (long long)params.rounds * params.keys;
+  size_t found = 0;
+  results.push_back(timeIt("lookup_uncached", lookups, [&]() {
+    for (int round = 0; round < params.rounds; round++) {
+      const vector<string>& scope = scopes[round % scopes.size()];
+      for (const string& keyPath : keyPaths) {
+        if (ctxt->resolveValueForKeyPath(keyPath, scope)) found++;
+      }
+    }
+  }));
+  results.push_back(timeIt("lookup_cached", lookups, [&]() {
+    for (int round = 0; round < params.rounds; round++) {
+      const vector<string>& scope = scopes[round % scopes.size()];
+      for (const string& keyPath : keyPaths) {
+        if (ctxt->valueForKeyPath(keyPath, scope)) found++;
+      }
+    }
+  }));
+  if (found != 2 * (size_t)lookups) {
+    cerr << "Warning: only " << found << " of " << 2 * lookups
+         << " lookups succeeded" << endl;
+  }
+
+  CConf::ConfigDouble handle(ctxt, keyPaths.front());
+  handle.setScope(scopes.front());
+  double checksum = 0;
+  results.push_back(timeIt("handle_read", lookups, [&]() {
+    for (long long i = 0; i < lookups; i++) checksum += handle;
+  }));
+
+  //  model traversal
+  long long rows = 0;
+  results.push_back(timeIt("model_traversal", 1, [&]() {
+    rows = traverseModel(ctxt.get(), QModelIndex());
+  }));
+  results.back().iterations = max(rows, 1LL);
+
+  //  reloads alternate between two versions of the last file
+  const string& lastPath = paths.back();
+  int reloads = min(params.rounds, 20);
+  double reloadMs = 0;
+  for (int i = 0; i < reloads; i++) {
+    writeJson(lastPath, i % 2 == 0 ? lastFileChanged : lastFile);
+    auto start = chrono::steady_clock::now();
+    ctxt->fileChanged(QString::fromStdString(lastPath));
+    reloadMs += elapsedMs(start);
+  }
+  results.push_back(BenchResult{"reload", reloads, reloadMs});
+
+  //  removal of the last file, re-adding it between rounds
+  double removeMs = 0;
+  for (int i = 0; i < reloads; i++) {
+    auto start = chrono::steady_clock::now();
+    ctxt->removeFile(lastPath);
+    removeMs += elapsedMs(start);
+    ctxt->addFile(lastPath);
+  }
+  results.push_back(BenchResult{"remove_file", reloads, removeMs});
+
+  printResults(params, results);
+  cerr << "checksum " << checksum << ", cache hits "
+       << ctxt->valueCache().hits() << ", misses "
+       << ctxt->valueCache().misses() << endl;
+  cerr << ctxt->stats().toJson() << endl;
+  return 0;
+}
@@ -0,0 +1,39 @@
+#include <iostream>
+#include <string>
+
+#include <QCoreApplication>
+
+#include "ConfigContext.hpp"
+
+using namespace std;
+
+//  Compiles a set of cascaded config files into a binary image that
+//  Context::loadImage() can serve from without parsing anything.
+//
+//  usage: cconf-compile <output image> <file>...
+//  Files are given lowest priority first, the same order they'd be passed to
+//  Context::addFile().
+
+int main(int argc, char** argv) {
+  if (argc < 3) {
+    cerr << "usage: " << argv[0] << " <output image> <file>..." << endl;
+    return 1;
+  }
+
+  QCoreApplication app(argc, argv);
+
+  try {
+    CConf::Context ctxt;
+    for (int i = 2; i < argc; i++) ctxt.addFile(argv[i]);
+    ctxt.writeImage(argv[1]);
+
+    CConf::BinaryImage image(argv[1]);
+    cout << "Wrote " << argv[1] << " (" << image.size() << " bytes, "
+         << image.files().size() << " files)" << endl;
+  } catch (const exception& e) {
+    cerr << "error: " << e.what() << endl;
+    return 1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,465 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <future>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <dirent.h>
+#include <unistd.h>
+
+#include <QCoreApplication>
+
+#include "ConfigContext.hpp"
+#include "StartupCache.hpp"
+
+using namespace std;
+using namespace CConf;
+
+//  Behavior tests.  Each test writes its config files into a fresh temp
+//  directory, and the program exits non-zero if any check failed.
+
+static int Failures = 0;
+
+static void Fail(const char* file, int line, const char* cond) {
+  cerr << file << ":" << line << ": check failed: " << cond << endl;
+  Failures++;
+}
+
+#define CHECK(cond)                               \
+  do {                                            \
+    if (!(cond)) Fail(__FILE__, __LINE__, #cond); \
+  } while (0)
+
+static string TempDir;
+
+static string WriteFile(const string& name, const string& contents) {
+  string path = TempDir + "/" + name;
+  ofstream out(path.c_str(), ios::binary | ios::trunc);
+  out << contents;
+  return path;
+}
+
+static bool IsInt(const Value* value, int64_t expected) {
+  return value && value->type() == Value::Int && value->toInt() == expected;
+}
+
+/// Runs the context's event loop until @future is ready
+template <typename T>
+static T Wait(future<T>& future) {
+  auto deadline = chrono::steady_clock::now() + chrono::seconds(10);
+  while (future.wait_for(chrono::milliseconds(1)) != future_status::ready &&
+         chrono::steady_clock::now() < deadline) {
+    QCoreApplication::processEvents();
+  }
+  return future.get();
+}
+
+static void TestSnapshotsAndViews() {
+  string base = WriteFile("views-base.json",
+                          "{\"motion\": {\"max_accel\": 2, \"max_vel\": 3},"
+                          " \"display\": {\"color\": \"red\"}}");
+  string robot = WriteFile("views-robot.json",
+                           "{\"$$robot1\": {\"motion\": {\"max_vel\": 5}}}");
+  Context ctxt;
+  ctxt.addFile(base);
+  ctxt.addFile(robot);
+
+  shared_ptr<const Snapshot> before = ctxt.snapshot();
+  CHECK(before->size() == 3);
+  CHECK(IsInt(before->value("motion.max_vel"), 3));
+  CHECK(IsInt(before->value("motion.max_vel", {"robot1"}), 5));
+
+  shared_ptr<const ScopeView> robotView = ctxt.view({"robot1"});
+  shared_ptr<const ScopeView> defaultView = ctxt.view();
+  CHECK(IsInt(robotView->value("motion.max_vel"), 5));
+  CHECK(IsInt(robotView->value("motion.max_accel"), 2));
+  CHECK(robotView->size() == 3);
+  //  only motion.max_vel is overridden
+  CHECK(robotView->sharedKeyPaths(*defaultView) == 2);
+
+  ctxt.setValue("motion.max_accel", Value(4), base);
+  shared_ptr<const Snapshot> after = ctxt.snapshot();
+  CHECK(after->version() == before->version() + 1);
+  CHECK(IsInt(before->value("motion.max_accel"), 2));
+  CHECK(IsInt(after->value("motion.max_accel"), 4));
+  //  unchanged leaves are shared with the previous snapshot
+  CHECK(before->value("display.color") == after->value("display.color"));
+
+  CHECK(IsInt(ctxt.view({"robot1"})->value("motion.max_accel"), 4));
+  CHECK(ctxt.view({"robot1"})->sharedKeyPaths(*ctxt.view()) == 2);
+
+  ctxt.removeFile(robot);
+  CHECK(ctxt.snapshot()->size() == 3);
+  CHECK(IsInt(ctxt.view({"robot1"})->value("motion.max_vel"), 3));
+  CHECK(ctxt.view({"robot1"})->sharedKeyPaths(*ctxt.view()) == 3);
+
+  ctxt.removeFile(base);
+  CHECK(ctxt.snapshot()->size() == 0);
+  CHECK(ctxt.view()->value("motion.max_vel") == nullptr);
+}
+
+static void TestSubscriptions() {
+  string path = WriteFile("subs.json",
+                          "{\"motion\": {\"max_accel\": 2, \"max_vel\": 3},"
+                          " \"display\": {\"color\": \"red\"}}");
+  Context ctxt;
+  ctxt.addFile(path);
+
+  vector<ValueChange> seen;
+  int calls = 0;
+  SubscriptionId id =
+      ctxt.subscribe("motion", [&](const vector<ValueChange>& changes) {
+        calls++;
+        for (const ValueChange& change : changes) {
+          CHECK(change.oldValue && change.newValue);
+          seen.push_back(change);
+        }
+      });
+
+  Context::Transaction txn = ctxt.beginTransaction();
+  txn.set("motion.max_accel", Value(7), path);
+  txn.set("motion.max_vel", Value(8), path);
+  txn.set("display.color", Value(string("blue")), path);
+  txn.commit();
+  //  one batch, without the display change
+  CHECK(calls == 1);
+  CHECK(seen.size() == 2);
+
+  //  setting the same value again isn't a change
+  ctxt.setValue("motion.max_accel", Value(7), path);
+  CHECK(calls == 1);
+
+  CHECK(ctxt.unsubscribe(id));
+  ctxt.setValue("motion.max_accel", Value(9), path);
+  CHECK(calls == 1);
+}
+
+static void TestReloadDiffing() {
+  string path = WriteFile("reload.json", "{\"a\": 1, \"b\": {\"c\": 2}}");
+  Context ctxt;
+  ctxt.addFile(path);
+
+  const ValueNode* a = (const ValueNode*)ctxt.nodeForKeyPath("a");
+  const ValueNode* c = (const ValueNode*)ctxt.nodeForKeyPath("b.c");
+  uint64_t aGeneration = a->generation();
+  uint64_t cGeneration = c->generation();
+  uint64_t version = ctxt.snapshotVersion();
+
+  WriteFile("reload.json", "{\"a\": 1, \"b\": {\"c\": 3}}");
+  ctxt.fileChanged(QString::fromStdString(path));
+  //  the unchanged value keeps its generation, the changed one doesn't
+  CHECK(a->generation() == aGeneration);
+  CHECK(c->generation() != cGeneration);
+  CHECK(IsInt(ctxt.valueForKeyPath("a"), 1));
+  CHECK(IsInt(ctxt.valueForKeyPath("b.c"), 3));
+  CHECK(ctxt.snapshotVersion() == version + 1);
+
+  //  another file makes "b" a branch for good, so a leaf can't replace it
+  string other = WriteFile("reload-other.json", "{\"b\": {\"d\": 4}}");
+  ctxt.addFile(other);
+  WriteFile("reload.json", "{\"a\": 1, \"b\": 5}");
+  ctxt.fileChanged(QString::fromStdString(path));
+  CHECK(!ctxt.containsFile(path));
+  CHECK(ctxt.containsFile(other));
+  CHECK(ctxt.valueForKeyPath("a") == nullptr);
+  CHECK(IsInt(ctxt.valueForKeyPath("b.d"), 4));
+  CHECK(ctxt.bytesUsedByFile(path) == 0);
+  //  it can be added again once fixed
+  WriteFile("reload.json", "{\"a\": 1}");
+  ctxt.addFile(path);
+  CHECK(IsInt(ctxt.valueForKeyPath("a"), 1));
+}
+
+static void TestKeyPathLookups() {
+  static constexpr KeyPath MaxVel("motion.max_vel");
+  string path = WriteFile(
+      "keypath.json",
+      "{\"motion\": {\"max_vel\": 2}, \"$$robot1\": {\"motion\": "
+      "{\"max_vel\": 3}}}");
+  shared_ptr<Context> ctxt = make_shared<Context>();
+  ctxt->addFile(path);
+
+  //  both overloads share one cache entry per key path and scope
+  CHECK(IsInt(ctxt->valueForKeyPath("motion.max_vel"), 2));
+  uint64_t hits = ctxt->valueCache().hits();
+  CHECK(IsInt(ctxt->valueForKeyPath(MaxVel), 2));
+  CHECK(ctxt->valueCache().hits() == hits + 1);
+  CHECK(IsInt(ctxt->valueForKeyPath(MaxVel, {"robot1"}), 3));
+  CHECK(IsInt(ctxt->valueForKeyPath("motion.max_vel", {"robot1"}), 3));
+  CHECK(ctxt->valueCache().hits() == hits + 2);
+
+  ConfigDouble maxVel(ctxt, MaxVel);
+  CHECK(maxVel.keyPath() == "motion.max_vel");
+  CHECK(maxVel.value() == 2);
+  maxVel.setScope({"robot1"});
+  CHECK(maxVel.value() == 3);
+}
+
+static void TestTransactions() {
+  string path = WriteFile("txn.json", "{\"a\": 1, \"b\": {\"c\": 2}}");
+  string other = WriteFile("txn-other.json", "{\"d\": 3}");
+  Context ctxt;
+  ctxt.addFile(path);
+  ctxt.addFile(other);
+
+  Context::Transaction txn = ctxt.beginTransaction();
+  txn.set("b.e", Value(5), path);
+  txn.set("f.g", Value(string("new")), path, {"robot1"});
+  txn.remove("a", path);
+  CHECK(txn.commit() == 3);
+  CHECK(ctxt.valueForKeyPath("a") == nullptr);
+  CHECK(IsInt(ctxt.valueForKeyPath("b.e"), 5));
+  CHECK(ctxt.valueForKeyPath("f.g") == nullptr);
+  CHECK(ctxt.valueForKeyPath("f.g", {"robot1"})->toString() == "new");
+  CHECK(ctxt.isDirty(path));
+  CHECK(!ctxt.isDirty(other));
+
+  Json::Value json = ctxt.extractJson(path);
+  CHECK(!json.isMember("a"));
+  CHECK(json["b"]["e"].asInt() == 5);
+  CHECK(json["$$robot1"]["f"]["g"].asString() == "new");
+
+  //  removing something the file doesn't define changes nothing
+  Context::Transaction noop = ctxt.beginTransaction();
+  noop.remove("missing", other);
+  noop.remove("b.c", other);
+  CHECK(noop.commit() == 0);
+  CHECK(!ctxt.isDirty(other));
+
+  //  a conflicting edit rolls back the whole batch
+  uint64_t version = ctxt.snapshotVersion();
+  Context::Transaction bad = ctxt.beginTransaction();
+  bad.set("d", Value(10), other);
+  bad.remove("b.c", path);
+  bad.set("b.c.x", Value(1), other);
+  bool threw = false;
+  try {
+    bad.commit();
+  } catch (const TypeMismatchError&) {
+    threw = true;
+  }
+  CHECK(threw);
+  CHECK(bad.size() == 3);
+  CHECK(IsInt(ctxt.valueForKeyPath("d"), 3));
+  CHECK(IsInt(ctxt.valueForKeyPath("b.c"), 2));
+  CHECK(!ctxt.isDirty(other));
+  CHECK(ctxt.snapshotVersion() == version);
+  CHECK(ctxt.extractJson(other)["d"].asInt() == 3);
+}
+
+static void TestAsyncLoads() {
+  string first = WriteFile("async-1.json", "{\"a\": 1, \"b\": 2}");
+  string second = WriteFile("async-2.json", "{\"a\": 3}");
+  string broken = WriteFile("async-broken.json", "{\"a\": ");
+  Context ctxt;
+
+  future<LoadResult> one = ctxt.addFileAsync(first);
+  future<LoadResult> two = ctxt.addFileAsync(second);
+  future<LoadResult> bad = ctxt.addFileAsync(broken);
+  future<LoadResult> missing = ctxt.removeFileAsync(TempDir + "/nope.json");
+  CHECK(Wait(one).ok());
+  CHECK(Wait(two).ok());
+  CHECK(Wait(bad).status == LoadResult::ParseError);
+  CHECK(Wait(missing).status == LoadResult::InvalidArgument);
+  //  applied in order, so the second file wins
+  CHECK(IsInt(ctxt.valueForKeyPath("a"), 3));
+  CHECK(ctxt.indexOfFile(first) == 0 && ctxt.indexOfFile(second) == 1);
+  CHECK(!ctxt.containsFile(broken));
+
+  future<LoadResult> removed = ctxt.removeFileAsync(second);
+  CHECK(Wait(removed).ok());
+  CHECK(IsInt(ctxt.valueForKeyPath("a"), 1));
+
+  //  a context destroyed with loads pending cancels them
+  future<LoadResult> cancelled;
+  {
+    Context doomed;
+    cancelled = doomed.addFileAsync(first);
+  }
+  CHECK(cancelled.get().status == LoadResult::Cancelled);
+}
+
+static void TestBinaryImage() {
+  string base = WriteFile("image-base.json",
+                          "{\"a\": 1, \"b\": {\"c\": \"a longer string value\","
+                          " \"d\": [1, 2.5, 3]}}");
+  string robot = WriteFile("image-robot.json",
+                           "{\"$$robot1\": {\"a\": 7}, \"e\": true}");
+  string imagePath = TempDir + "/config.img";
+  {
+    Context ctxt;
+    ctxt.addFile(base);
+    ctxt.addFile(robot);
+    ctxt.writeImage(imagePath);
+  }
+
+  {
+    Context ctxt;
+    ctxt.loadImage(imagePath);
+    CHECK(IsInt(ctxt.valueForKeyPath("a"), 1));
+    CHECK(IsInt(ctxt.valueForKeyPath("a", {"robot1"}), 7));
+    CHECK(ctxt.valueForKeyPath("b.c")->toString() == "a longer string value");
+    const Value* list = ctxt.valueForKeyPath("b.d");
+    CHECK(list && list->listSize() == 3 && list->listAt(1).toDouble() == 2.5);
+    CHECK(ctxt.valueForKeyPath("e")->toBool());
+    CHECK(ctxt.valueForKeyPath("missing") == nullptr);
+    CHECK(ctxt.image()->files().size() == 2);
+  }
+
+  string image;
+  {
+    ifstream in(imagePath.c_str(), ios::binary);
+    image.assign(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+  }
+  CHECK(image.size() > 64);
+
+  //  truncated, and every 4-byte word past the header garbled in turn
+  vector<string> corrupt;
+  corrupt.push_back(image.substr(0, image.size() / 2));
+  for (size_t offset = 16; offset + 4 <= image.size(); offset += 4) {
+    string bad = image;
+    bad[offset] = bad[offset + 1] = bad[offset + 2] = bad[offset + 3] =
+        (char)0x7f;
+    corrupt.push_back(bad);
+  }
+
+  string corruptPath = TempDir + "/corrupt.img";
+  for (const string& bad : corrupt) {
+    WriteFile("corrupt.img", bad);
+    try {
+      BinaryImage opened(corruptPath);
+      //  whatever was accepted has to be safe to read
+      for (const char* keyPath : {"a", "b.c", "b.d", "e", "missing"}) {
+        ImageValue value = opened.find(keyPath, {"robot1"});
+        if (value.isValid()) value.toValue();
+      }
+      opened.files();
+    } catch (const runtime_error&) {
+    }
+  }
+  unlink(corruptPath.c_str());
+
+  WriteFile("corrupt.img", image.substr(0, image.size() / 2));
+  bool threw = false;
+  try {
+    BinaryImage truncated(corruptPath);
+  } catch (const runtime_error&) {
+    threw = true;
+  }
+  CHECK(threw);
+}
+
+static void TestStartupCache() {
+  string base = WriteFile("cache-base.json", "{\"a\": 1, \"b\": [1, 2]}");
+  string robot = WriteFile("cache-robot.json", "{\"a\": 2}");
+  string cachePath = TempDir + "/startup.cache";
+  vector<string> files = {base, robot};
+
+  {
+    Context ctxt;
+    ctxt.setStartupCache(cachePath);
+    ctxt.addFiles(files);
+    CHECK(ctxt.stats().counter(ContextStats::StartupCacheMisses) == 1);
+  }
+  {
+    Context ctxt;
+    ctxt.setStartupCache(cachePath);
+    ctxt.addFiles(files);
+    CHECK(ctxt.stats().counter(ContextStats::StartupCacheHits) == 1);
+    CHECK(ctxt.stats().counter(ContextStats::FilesParsed) == 0);
+    CHECK(IsInt(ctxt.valueForKeyPath("a"), 2));
+  }
+
+  //  same size and, likely, the same mtime - only the contents differ
+  WriteFile("cache-robot.json", "{\"a\": 3}");
+  {
+    Context ctxt;
+    ctxt.setStartupCache(cachePath);
+    ctxt.addFiles(files);
+    CHECK(ctxt.stats().counter(ContextStats::StartupCacheMisses) == 1);
+    CHECK(IsInt(ctxt.valueForKeyPath("a"), 3));
+  }
+
+  //  a different file order is a different cache
+  {
+    vector<FileStamp> reversed;
+    string contents;
+    reversed.push_back(StampFile(robot, &contents));
+    reversed.push_back(StampFile(base, &contents));
+    vector<Tree> trees;
+    CHECK(!LoadStartupCache(cachePath, reversed, &trees));
+  }
+  unlink(cachePath.c_str());
+}
+
+static void TestPackedListPrecision() {
+  const int64_t big = (1ll << 53) + 1;
+  Value ints(vector<Value>{Value(1), Value(big), Value(-big)});
+  CHECK(ints.isNumberList());
+  CHECK(ints.listAt(0).type() == Value::Int && ints.listAt(0).toInt() == 1);
+  CHECK(ints.listAt(1).type() == Value::Int && ints.listAt(1).toInt() == big);
+  CHECK(ints.listAt(2).toInt() == -big);
+  CHECK(ints == Value(vector<Value>{Value(1), Value(big), Value(-big)}));
+  CHECK(ints != Value(vector<Value>{Value(1), Value(big + 1), Value(-big)}));
+
+  const uint64_t huge = UINT64_MAX;
+  Value uints(vector<Value>{Value(huge), Value(1)});
+  CHECK(uints.listAt(0).type() == Value::UInt);
+  CHECK((uint64_t)uints.listAt(0).toInt() == huge);
+
+  Value mixed(vector<Value>{Value(3), Value(0.5)});
+  CHECK(mixed.listAt(0).type() == Value::Int && mixed.listAt(0).toInt() == 3);
+  CHECK(mixed.listAt(1).type() == Value::Double);
+  CHECK(mixed.doubles().size() == 2);
+
+  //  and through a file
+  string path = WriteFile("precision.json",
+                          "{\"big\": [9007199254740993, -9007199254740993],"
+                          " \"scalar\": 9007199254740993}");
+  Context ctxt;
+  ctxt.addFile(path);
+  const Value* list = ctxt.valueForKeyPath("big");
+  CHECK(list && list->listAt(0).toInt() == big);
+  CHECK(list && list->listAt(1).toInt() == -big);
+  CHECK(IsInt(ctxt.valueForKeyPath("scalar"), big));
+}
+
+int main(int argc, char** argv) {
+  QCoreApplication app(argc, argv);
+
+  char dir[] = "/tmp/cconf-test-XXXXXX";
+  if (!mkdtemp(dir)) {
+    perror("mkdtemp");
+    return 1;
+  }
+  TempDir = dir;
+
+  TestSnapshotsAndViews();
+  TestSubscriptions();
+  TestReloadDiffing();
+  TestKeyPathLookups();
+  TestTransactions();
+  TestAsyncLoads();
+  TestBinaryImage();
+  TestStartupCache();
+  TestPackedListPrecision();
+
+  //  the tests only create plain files
+  if (DIR* listing = opendir(TempDir.c_str())) {
+    while (dirent* entry = readdir(listing)) {
+      string name = entry->d_name;
+      if (name != "." && name != "..") unlink((TempDir + "/" + name).c_str());
+    }
+    closedir(listing);
+  }
+  rmdir(TempDir.c_str());
+
+  if (Failures) {
+    cerr << Failures << " check(s) failed" << endl;
+    return 1;
+  }
+  cout << "All tests passed" << endl;
+  return 0;
+}